@@ -4,71 +4,232 @@
  */
 
 #include "pin.H"
+#include "HW1Result.h"
+#include "HW1Core.h"
+#include "HW1Trace.h"
+#include "HW1Layout.h"
 #include <iostream>
 #include <fstream>
-#include <unordered_set>
+#include <vector>
 #include <map>
 #include <chrono>
+#include <cstdlib>
+#include <cstddef>
+#include <algorithm>
+#include <deque>
+#include <cctype>
+#include <limits>
 
 using std::cerr;
 using std::endl;
-using std::map;
 using std::string;
-using std::unordered_set;
+using std::map;
+using std::pair;
 
 UINT32 granularity = 4; // bytes
 
 /* ================================================================== */
 // Custom Structures
 /* ================================================================== */
-typedef struct _InstMetrics
-{
-    UINT64 numLoads = 0;
-    UINT64 numStores = 0;
-    UINT64 numNops = 0;
-    UINT64 numDirectCalls = 0;
-    UINT64 numIndirectCalls = 0;
-    UINT64 numReturns = 0;
-    UINT64 numUncondBranches = 0;
-    UINT64 numCondBranches = 0;
-    UINT64 numLogicalOps = 0;
-    UINT64 numRotateShift = 0;
-    UINT64 numFlagOps = 0;
-    UINT64 numVector = 0;
-    UINT64 numCondMoves = 0;
-    UINT64 numMMXSSE = 0;
-    UINT64 numSysCalls = 0;
-    UINT64 numFP = 0;
-    UINT64 numRest = 0;
-} InstMetrics;
+
+// Per thread line of the report
+typedef struct _ThreadReport
+{
+    THREADID tid;
+    UINT64 insCount;
+    InstMetrics instMetrics;
+    UINT64 dataBlocks;
+    UINT64 insBlocks;
+} ThreadReport;
+
+// Routine of the hot code profile, symbolized at instrumentation time
+typedef struct _RoutineInfo
+{
+    string name;
+    string symbol; // as the linker knows it, for the -layout ordering file
+    string image;
+    ADDRINT address;
+    UINT64 size;
+    BOOL mainImage;
+} RoutineInfo;
+
+// Loop of the hot code profile, found from a direct branch back to head at tail
+typedef struct _LoopInfo
+{
+    ADDRINT head;
+    ADDRINT tail;
+    UINT32 routine;
+} LoopInfo;
+
+// One entry of the Pin trace buffer in -trace mode
+typedef struct _TraceRecord
+{
+    ADDRINT ip;
+    ADDRINT ea; // instructions in the block for TRACE_BLOCK
+    UINT32 size;
+    UINT32 type;
+} TraceRecord;
+
+// Adds the time until the end of its scope to one of the tool overhead counters
+class ToolTimer
+{
+  public:
+    ToolTimer(volatile UINT64 *nanos) : nanos(nanos), begin(std::chrono::steady_clock::now()) {}
+    ~ToolTimer()
+    {
+        __sync_add_and_fetch(nanos, (UINT64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+    }
+
+  private:
+    volatile UINT64 *nanos;
+    std::chrono::steady_clock::time_point begin;
+};
+
+// Memory operands passed to one PredicatedAnalysisMetricsMem call, the others
+// get a RecordDataAccess call each. Keeps the argument count below Pin's limit.
+#define PACKED_MEM_OPERANDS 4
+
+// Analysis routines counted by -call_counts for the benchmark driver in bench/
+enum
+{
+    CALL_CHECK_FAST_FORWARD = 0,
+    CALL_INS_COUNT,
+    CALL_CHECK_TERMINATE,
+    CALL_BBL_COUNT,
+    CALL_ANALYSIS_METRICS,
+    CALL_PREDICATED,
+    CALL_PREDICATED_MEM, // one per number of packed operands
+    CALL_DATA_ACCESS = CALL_PREDICATED_MEM + PACKED_MEM_OPERANDS,
+    CALL_FETCH,
+    CALL_BRANCH,
+    CALL_PREFETCH,
+    CALL_TIME_BLOCK,
+    CALL_TAKEN,
+    CALL_KINDS
+};
+const char *const callNames[CALL_KINDS] = {"CheckFastForward", "DoInsCount", "CheckTerminate", "DoBblCount",
+                                           "AnalysisMetrics", "PredicatedAnalysisMetrics", "PredicatedAnalysisMetricsMem<1>",
+                                           "PredicatedAnalysisMetricsMem<2>", "PredicatedAnalysisMetricsMem<3>",
+                                           "PredicatedAnalysisMetricsMem<4>",
+                                           "RecordDataAccess", "FetchBbl", "Branch", "RecordPrefetch", "TimeBlock",
+                                           "CountTaken"};
+
+// Analysis routine instances for one METRIC_ mask, see SelectAnalysisRoutines
+typedef struct _AnalysisRoutines
+{
+    AFUNPTR analysisMetrics;
+    AFUNPTR predicated;
+    AFUNPTR predicatedMem[PACKED_MEM_OPERANDS]; // by number of packed memory operands - 1
+    AFUNPTR dataAccess;
+} AnalysisRoutines;
+
+// Full trace buffer waiting for the writer thread
+typedef struct _PendingBuffer
+{
+    THREADID tid;
+    TraceRecord *records;
+    UINT64 numRecords;
+} PendingBuffer;
 
 /* ================================================================== */
 // Global variables
 /* ================================================================== */
 // UTILS
-UINT64 insCount = 0; // number of dynamically executed instructions
+UINT64 insCount = 0; // number of dynamically executed instructions, updated by SyncCount()
 UINT64 fastForward = 0;
+UINT64 windowStart = 0; // instruction count at which the current window starts
+UINT64 windowEnd = 0;
+UINT64 windowLength = 0;
+UINT64 windowPeriod = 0; // distance between the starts of consecutive windows
+UINT32 numWindows = 1;
+UINT32 windowIndex = 0;
+std::ostream *bbvOut = 0;
+BOOL detailPhase = FALSE; // TRUE once fast forward is over and full instrumentation is in place
+volatile UINT32 windowBusy = 0; // set while one thread reports a window
 std::ostream *out = &cerr;
 std::chrono::time_point<std::chrono::system_clock> startTime;
-// PART A+B
-InstMetrics *instMetrics = 0;
-// PART C
-unordered_set<UINT64> dataFootprint;
-unordered_set<UINT64> insFootprint;
-// PART D
-map<UINT32, UINT64> insLengthMap;
-map<UINT32, UINT64> insOperandsMap;
-map<UINT32, UINT64> insRegReadMap;
-map<UINT32, UINT64> insRegWriteMap;
-map<UINT32, UINT64> insMemOperandsMap;
-map<UINT32, UINT64> insMemReadMap;
-map<UINT32, UINT64> insMemWriteMap;
-UINT64 insMemTouched = 0;
-UINT64 insMemTouchedMax = 0;
-INT32 immediateMax = INT32_MIN;
-INT32 immediateMin = INT32_MAX;
-ADDRDELTA displacementMax = INT32_MIN;
-ADDRDELTA displacementMin = INT32_MAX;
+// THREADS
+TLS_KEY metricsKey = INVALID_TLS_KEY;
+REG metricsReg; // tool register caching the current thread's Metrics
+REG budgetReg;  // tool register counting the thread's instruction budget down, see SetBudget
+PIN_LOCK metricsLock; // guards the lists below and the BBL records
+vector<Metrics *> liveMetrics;
+Metrics *retiredMetrics = 0; // merged shards of the threads that exited in this window
+Metrics *totalMetrics = 0;
+vector<ThreadReport> threadReports;
+UINT32 numThreads = 0;
+UINT32 numLiveThreads = 0;
+vector<UINT64> bbvCounts; // execution counts per block id, summed over threads
+BOOL collectBbv = FALSE;
+// BINARY RESULTS
+HW1ResultWriter *resultWriter = 0;
+HW1ResultTable *windowTable = 0;
+HW1ResultTable *threadTable = 0;
+HW1ResultTable *bbvTable = 0;
+HW1ResultTable *blockTable = 0;
+// METRIC GROUPS, see -metrics
+UINT32 metricMask = METRIC_ALL;
+AnalysisRoutines analysisRoutines;
+// CACHE MODEL
+BOOL cacheModel = FALSE;
+CacheConfig cacheConfigs[CACHE_LEVELS];
+UINT32 cachePolicy = CACHE_POLICY_LRU;
+// BRANCH MODEL
+BOOL branchModel = FALSE;
+UINT32 branchPredictors[MAX_BRANCH_PREDICTORS];
+UINT32 numBranchPredictors = 0;
+// PREFETCH MODEL
+BOOL prefetchModel = FALSE;
+// TIMING MODEL
+BOOL timingModel = FALSE;
+// TLB MODEL
+BOOL tlbModel = FALSE;
+TlbConfig tlbConfigs[TLB_LEVELS];
+// TRACE CAPTURE
+BOOL traceMode = FALSE;
+BUFFER_ID traceBuffer = BUFFER_ID_INVALID;
+PIN_LOCK traceLock; // guards the two buffer lists
+std::deque<PendingBuffer> pendingBuffers;
+vector<TraceRecord *> freeBuffers;
+PIN_THREAD_UID traceWriterUid;
+volatile BOOL traceWriterExit = FALSE;
+// only touched by the writer thread, and by Fini once it is gone
+HW1TraceEncoder traceEncoder;
+map<THREADID, std::ofstream *> traceFiles;
+UINT32 traceFormat = TRACE_FORMAT_VARINT;
+UINT64 traceRecords = 0;
+UINT64 traceBytes = 0;
+// BBL summary mode, keyed by (address, number of instructions)
+map<pair<ADDRINT, UINT32>, BblSummary *> bblSummaries;
+// HOT CODE PROFILE, indexed by block id and guarded by metricsLock
+BOOL hotCode = FALSE;
+vector<RoutineInfo> routines; // 0 is code without a routine
+map<ADDRINT, UINT32> routineIds;
+vector<UINT32> blockRoutines;
+vector<UINT64> blockTotals; // executions over all windows and threads
+vector<UINT64> blockTouches; // data blocks first touched in a window
+map<pair<ADDRINT, ADDRINT>, LoopInfo> loops;
+// CODE LAYOUT, the edge profile, indexed by block id and guarded by metricsLock too
+BOOL layoutProfile = FALSE;
+vector<LayoutBlock> layoutBlocks; // static part, executions filled in at exit
+vector<UINT64> blockTaken;        // taken executions of the conditional branch ending each block
+// CALL COUNTS
+BOOL countCalls = FALSE;
+UINT64 callCounts[CALL_KINDS];
+// PROGRESS, only touched by the progress thread, and by Fini once it is gone
+std::ofstream *progressOut = 0;
+PIN_THREAD_UID progressUid;
+volatile BOOL progressExit = FALSE;
+std::chrono::steady_clock::time_point progressStart;
+std::chrono::steady_clock::time_point lastSample;
+UINT64 lastSampleIns = 0;
+FLT64 lastRowSeconds = 0;
+UINT64 lastRowIns = 0;
+FLT64 phaseSeconds[2] = {0, 0}; // fast forward or skip, detail
+UINT64 phaseIns[2] = {0, 0};
+// time the tool spends outside the analysis routines, updated by any thread
+volatile UINT64 instrumentNanos = 0;
+volatile UINT64 reportNanos = 0;
 
 /* ===================================================================== */
 // Command line switches
@@ -79,6 +240,144 @@ KNOB<string>
 KNOB<UINT64> KnobFastForward(KNOB_MODE_WRITEONCE, "pintool", "f", "0",
                              "fast forward this many billion instructions before starting to collect data");
 
+KNOB<UINT64> KnobWindowLength(KNOB_MODE_WRITEONCE, "pintool", "w", "1000",
+                              "number of instructions (in millions) measured in each window");
+
+KNOB<UINT32> KnobWindowCount(KNOB_MODE_WRITEONCE, "pintool", "n", "1",
+                             "number of windows to measure");
+
+KNOB<UINT64> KnobWindowPeriod(KNOB_MODE_WRITEONCE, "pintool", "p", "0",
+                              "distance (in millions of instructions) between window starts, 0 means back to back");
+
+KNOB<string> KnobBbvFile(KNOB_MODE_WRITEONCE, "pintool", "bbv", "",
+                         "write SimPoint style basic block vectors, one per window, to this file");
+
+KNOB<string> KnobResultFile(KNOB_MODE_WRITEONCE, "pintool", "ob", "",
+                            "also write the results in the binary columnar format to this file (see HW1Dump)");
+
+KNOB<string> KnobMetrics(KNOB_MODE_WRITEONCE, "pintool", "metrics", "all",
+                          "metric groups to measure: comma separated mix, footprint and partd, or all");
+
+KNOB<BOOL> KnobCacheModel(KNOB_MODE_WRITEONCE, "pintool", "cache", "0",
+                          "simulate the cache hierarchy and report a latency weighted CPI in PART B");
+
+KNOB<string> KnobL1D(KNOB_MODE_WRITEONCE, "pintool", "l1d", "32:8:64:1",
+                     "L1 data cache as size in KB:ways:line bytes:latency");
+
+KNOB<string> KnobL1I(KNOB_MODE_WRITEONCE, "pintool", "l1i", "32:8:64:1",
+                     "L1 instruction cache as size in KB:ways:line bytes:latency");
+
+KNOB<string> KnobL2(KNOB_MODE_WRITEONCE, "pintool", "l2", "256:8:64:10",
+                    "unified L2 cache as size in KB:ways:line bytes:latency, size 0 removes the level");
+
+KNOB<string> KnobLLC(KNOB_MODE_WRITEONCE, "pintool", "llc", "2048:16:64:30",
+                     "last level cache as size in KB:ways:line bytes:latency, size 0 removes the level");
+
+KNOB<UINT32> KnobMemLatency(KNOB_MODE_WRITEONCE, "pintool", "mem_latency", "70",
+                            "latency of an access that misses every cache level");
+
+KNOB<string> KnobCachePolicy(KNOB_MODE_WRITEONCE, "pintool", "cache_policy", "lru",
+                             "replacement policy of every level: lru, plru, fifo or random");
+
+KNOB<BOOL> KnobBranchModel(KNOB_MODE_WRITEONCE, "pintool", "branch", "0",
+                           "simulate branch predictors, a BTB and a return address stack and add the penalty to the PART B CPI");
+
+KNOB<string> KnobBranchPredictors(KNOB_MODE_WRITEONCE, "pintool", "branch_predictors", "gshare,bimodal,tage",
+                                  "comma separated direction predictors to compare, the first one drives the CPI");
+
+KNOB<UINT32> KnobBranchTableBits(KNOB_MODE_WRITEONCE, "pintool", "branch_table_bits", "14",
+                                 "log2 of the counters per direction predictor");
+
+KNOB<UINT32> KnobBtbBits(KNOB_MODE_WRITEONCE, "pintool", "btb_bits", "12",
+                         "log2 of the BTB entries used for indirect jumps and calls");
+
+KNOB<UINT32> KnobRasSize(KNOB_MODE_WRITEONCE, "pintool", "ras", "16",
+                         "return address stack entries, at most 64");
+
+KNOB<UINT32> KnobBranchPenalty(KNOB_MODE_WRITEONCE, "pintool", "branch_penalty", "15",
+                               "cycles lost on every mispredicted branch");
+
+KNOB<BOOL> KnobPrefetch(KNOB_MODE_WRITEONCE, "pintool", "prefetch", "0",
+                        "add next-line, stride and stream prefetchers behind a -l1d sized L1D and the load stride classes to PART B");
+
+KNOB<UINT32> KnobPrefetchTableBits(KNOB_MODE_WRITEONCE, "pintool", "prefetch_table_bits", "8",
+                                   "log2 of the entries of the stride prefetcher's reference prediction table");
+
+KNOB<UINT32> KnobPrefetchDegree(KNOB_MODE_WRITEONCE, "pintool", "prefetch_degree", "2",
+                                "lines every prefetcher requests ahead, at most 16");
+
+KNOB<BOOL> KnobTiming(KNOB_MODE_WRITEONCE, "pintool", "timing", "0",
+                      "add an out of order dataflow timing model (IPC, critical path, MLP) to PART B, needs -bbl_summary 1");
+
+KNOB<UINT32> KnobRobSize(KNOB_MODE_WRITEONCE, "pintool", "rob", "224",
+                         "reorder buffer entries of the timing model");
+
+KNOB<UINT32> KnobIssueWidth(KNOB_MODE_WRITEONCE, "pintool", "issue_width", "4",
+                            "instructions the timing model dispatches and retires per cycle");
+
+KNOB<BOOL> KnobTlb(KNOB_MODE_WRITEONCE, "pintool", "tlb", "0",
+                   "add the TLB model, with 4KB and 2MB pages, to PART B and the page footprint to PART C");
+
+KNOB<string> KnobDtlb(KNOB_MODE_WRITEONCE, "pintool", "dtlb", "64:4", "L1 data TLB as entries:ways");
+
+KNOB<string> KnobItlb(KNOB_MODE_WRITEONCE, "pintool", "itlb", "128:8", "L1 instruction TLB as entries:ways");
+
+KNOB<string> KnobStlb(KNOB_MODE_WRITEONCE, "pintool", "stlb", "1536:12", "unified second level TLB as entries:ways, 0:0 for none");
+
+KNOB<UINT32> KnobPageWalk(KNOB_MODE_WRITEONCE, "pintool", "page_walk", "30", "cycles of a page walk, a miss in both TLB levels");
+
+KNOB<UINT32> KnobFootprintBudget(KNOB_MODE_WRITEONCE, "pintool", "footprint_budget", "64",
+                                 "MB of exact block set per footprint before it is estimated by a sketch, 0 for always exact");
+
+KNOB<UINT32> KnobFootprintSketchBits(KNOB_MODE_WRITEONCE, "pintool", "footprint_sketch_bits", "14",
+                                     "log2 of the registers of the footprint sketch, standard error 1.04 / sqrt(2^bits)");
+
+KNOB<BOOL> KnobReuse(KNOB_MODE_WRITEONCE, "pintool", "reuse", "0",
+                     "add the reuse distance histogram and the working set curve of the data blocks to PART C");
+
+KNOB<UINT32> KnobReuseSample(KNOB_MODE_WRITEONCE, "pintool", "reuse_sample", "1",
+                             "follow one in this many data blocks for the reuse profile (SHARDS), 1 is exact");
+
+KNOB<UINT64> KnobReuseBudget(KNOB_MODE_WRITEONCE, "pintool", "reuse_budget", "262144",
+                             "most blocks followed per thread when sampling, fewer blocks are sampled to stay within it");
+
+KNOB<UINT64> KnobReuseInterval(KNOB_MODE_WRITEONCE, "pintool", "reuse_interval", "10000000",
+                               "data block accesses per point of the working set curve");
+
+KNOB<BOOL> KnobHotCode(KNOB_MODE_WRITEONCE, "pintool", "hot", "0",
+                        "attribute instructions, loads, stores and data footprint to routines, images and loops and print the hottest at exit");
+
+KNOB<UINT32> KnobHotTop(KNOB_MODE_WRITEONCE, "pintool", "hot_top", "10",
+                        "routines, loops and instructions listed by the hot code report");
+
+KNOB<string> KnobLayoutFile(KNOB_MODE_WRITEONCE, "pintool", "layout", "",
+                            "profile the taken edges between blocks, print code layout advice at exit and write the "
+                            "main image's hot routines to this linker symbol ordering file");
+
+KNOB<BOOL> KnobCallCounts(KNOB_MODE_WRITEONCE, "pintool", "call_counts", "0",
+                          "count the executions of every analysis routine and print them at exit, for bench/run.sh");
+
+KNOB<string> KnobProgressFile(KNOB_MODE_WRITEONCE, "pintool", "progress", "",
+                              "append a progress and metrics snapshot line to this file while the application runs");
+
+KNOB<UINT32> KnobProgressInterval(KNOB_MODE_WRITEONCE, "pintool", "progress_interval", "60",
+                                  "seconds between two progress lines");
+
+KNOB<string> KnobTraceFile(KNOB_MODE_WRITEONCE, "pintool", "trace", "",
+                           "capture the block and memory access stream to <prefix>.<tid>.hw1t instead of analysing it inline");
+
+KNOB<BOOL> KnobTraceRaw(KNOB_MODE_WRITEONCE, "pintool", "trace_raw", "0",
+                         "write the trace records uncompressed, 24 bytes each, for the fastest replay");
+
+KNOB<UINT32> KnobTracePages(KNOB_MODE_WRITEONCE, "pintool", "trace_pages", "64",
+                            "pages per trace buffer");
+
+KNOB<UINT32> KnobTraceBuffers(KNOB_MODE_WRITEONCE, "pintool", "trace_buffers", "64",
+                              "full trace buffers allowed to wait for the writer thread before application threads wait");
+
+KNOB<BOOL> KnobBblSummary(KNOB_MODE_WRITEONCE, "pintool", "bbl_summary", "1",
+                          "aggregate static metrics per basic block instead of per instruction analysis calls");
+
 /* ===================================================================== */
 // Utilities
 /* ===================================================================== */
@@ -98,147 +397,637 @@ INT32 Usage()
 // Analysis routines
 /* ===================================================================== */
 
-#define RECORDFOOTPRINT(startaddr, size, container)                                                                                         \
-    do                                                                                                                                      \
-    {                                                                                                                                       \
-        for (UINT64 addr = (UINT64)startaddr / 32; addr < ((UINT64)startaddr + size) / 32 + (((UINT64)startaddr + size) % 32 != 0); addr++) \
-            container.insert(addr);                                                                                                         \
-    } while (0)
+#define PREDICATED_MEM_BASE_SIGNATURE Metrics *m, UINT32 insTypeOffset, UINT32 numLoads, UINT32 numStores, UINT32 readOperands, UINT32 writeOperands, ADDRDELTA insDisplacementMax, ADDRDELTA insDisplacementMin, UINT32 blockId
+
+// The analysis routines are templates on the METRIC_ mask of HW1Core.h, every
+// group left out of the mask compiles away. AnalysisRoutines below holds the
+// instances for the mask of this run.
+
+// Data part of the memory operands, given as (address, size) pairs
+template <UINT32 MASK>
+inline VOID RecordOperands(Metrics *m, UINT32 blockId)
+{
+}
+
+template <UINT32 MASK, typename... OPS>
+inline VOID RecordOperands(Metrics *m, UINT32 blockId, void *memOpAddr, UINT32 memOpSize, OPS... ops)
+{
+    m->RecordData<MASK>((ADDRINT)memOpAddr, memOpSize, blockId);
+    RecordOperands<MASK>(m, blockId, ops...);
+}
+
+template <UINT32 MASK, typename... OPS>
+VOID PredicatedAnalysisMetricsMem(PREDICATED_MEM_BASE_SIGNATURE, UINT32 memTouched, OPS... ops)
+{
+    m->RecordMemIns<MASK>(insTypeOffset, numLoads, numStores, readOperands, writeOperands, insDisplacementMax, insDisplacementMin);
+    m->RecordMemTouched<MASK>(memTouched);
+    RecordOperands<MASK>(m, blockId, ops...);
+}
+
+template <UINT32 MASK>
+VOID PredicatedAnalysisMetrics(Metrics *m, UINT32 insTypeOffset)
+{
+    m->RecordNoMemIns<MASK>(insTypeOffset);
+}
+
+template <UINT32 MASK>
+VOID AnalysisMetrics(Metrics *m, void *insAddr, UINT32 insSize, UINT32 operandsCount, UINT32 regReadCount, UINT32 regWriteCount, ADDRDELTA insImmediateMin, ADDRDELTA insImmediateMax)
+{
+    m->RecordIns<MASK>((ADDRINT)insAddr, insSize, operandsCount, regReadCount, regWriteCount, insImmediateMin, insImmediateMax);
+}
+
+template <UINT32 MASK>
+VOID RecordDataAccess(Metrics *m, void *memOpAddr, UINT32 memOpSize, UINT32 blockId)
+{
+    m->RecordData<MASK>((ADDRINT)memOpAddr, memOpSize, blockId);
+}
+
+#define MEM_OP void *, UINT32
+
+struct SelectAnalysisRoutines
+{
+    AnalysisRoutines *routines;
+    template <UINT32 MASK>
+    VOID Run()
+    {
+        routines->analysisMetrics = (AFUNPTR)AnalysisMetrics<MASK>;
+        routines->predicated = (AFUNPTR)PredicatedAnalysisMetrics<MASK>;
+        routines->predicatedMem[0] = (AFUNPTR)PredicatedAnalysisMetricsMem<MASK, MEM_OP>;
+        routines->predicatedMem[1] = (AFUNPTR)PredicatedAnalysisMetricsMem<MASK, MEM_OP, MEM_OP>;
+        routines->predicatedMem[2] = (AFUNPTR)PredicatedAnalysisMetricsMem<MASK, MEM_OP, MEM_OP, MEM_OP>;
+        routines->predicatedMem[3] = (AFUNPTR)PredicatedAnalysisMetricsMem<MASK, MEM_OP, MEM_OP, MEM_OP, MEM_OP>;
+        routines->dataAccess = (AFUNPTR)RecordDataAccess<MASK>;
+    }
+};
+
+VOID PIN_FAST_ANALYSIS_CALL FetchBbl(Metrics *m, ADDRINT bblAddr, UINT32 bblSize)
+{
+    m->RecordFetch(bblAddr, bblSize);
+}
+
+VOID PIN_FAST_ANALYSIS_CALL BranchConditional(Metrics *m, ADDRINT pc, BOOL taken)
+{
+    m->branches.Conditional(pc, taken);
+}
+
+VOID PIN_FAST_ANALYSIS_CALL BranchIndirect(Metrics *m, ADDRINT pc, ADDRINT target)
+{
+    m->branches.Indirect(pc, target);
+}
 
-#define RECORDMEM                                          \
-    do                                                     \
-    {                                                      \
-        *insTypeAddr += 1;                                 \
-        instMetrics->numLoads += numLoads;                 \
-        instMetrics->numStores += numStores;               \
-        insMemOperandsMap[readOperands + writeOperands]++; \
-        insMemReadMap[readOperands]++;                     \
-        insMemWriteMap[writeOperands]++;                   \
-        if (displacementMin > insDisplacementMin)          \
-            displacementMin = insDisplacementMin;          \
-        if (displacementMax < insDisplacementMax)          \
-            displacementMax = insDisplacementMax;          \
-    } while (0)
+VOID PIN_FAST_ANALYSIS_CALL BranchCall(Metrics *m, ADDRINT returnAddress)
+{
+    m->branches.Call(returnAddress);
+}
 
-#define PREDICATED_MEM_BASE_SIGNATURE UINT64 *insTypeAddr, UINT32 numLoads, UINT32 numStores, UINT32 readOperands, UINT32 writeOperands, ADDRDELTA insDisplacementMax, ADDRDELTA insDisplacementMin
+VOID PIN_FAST_ANALYSIS_CALL BranchIndirectCall(Metrics *m, ADDRINT pc, ADDRINT target, ADDRINT returnAddress)
+{
+    m->branches.Indirect(pc, target);
+    m->branches.Call(returnAddress);
+}
 
-VOID PredicatedAnalysisMetrics1Mem(PREDICATED_MEM_BASE_SIGNATURE, void *memOpAddr1, UINT32 memOpSize1)
+VOID PIN_FAST_ANALYSIS_CALL BranchReturn(Metrics *m, ADDRINT target)
 {
-    RECORDMEM;
-    RECORDFOOTPRINT(memOpAddr1, memOpSize1, dataFootprint);
-    insMemTouched += memOpSize1;
-    if (memOpSize1 > insMemTouchedMax)
-        insMemTouchedMax = memOpSize1;
+    m->branches.Return(target);
 }
 
-VOID PredicatedAnalysisMetrics2Mem(PREDICATED_MEM_BASE_SIGNATURE, void *memOpAddr1, UINT32 memOpSize1, void *memOpAddr2, UINT32 memOpSize2)
+VOID PIN_FAST_ANALYSIS_CALL TimeBlock(Metrics *m, const BblSummary *summary)
 {
-    RECORDMEM;
-    RECORDFOOTPRINT(memOpAddr1, memOpSize1, dataFootprint);
-    RECORDFOOTPRINT(memOpAddr2, memOpSize2, dataFootprint);
-    insMemTouched += memOpSize1 + memOpSize2;
-    if (memOpSize1 + memOpSize2 > insMemTouchedMax)
-        insMemTouchedMax = memOpSize1 + memOpSize2;
+    m->TimeBlock(summary);
 }
 
-VOID PredicatedAnalysisMetrics3Mem(PREDICATED_MEM_BASE_SIGNATURE, void *memOpAddr1, UINT32 memOpSize1, void *memOpAddr2, UINT32 memOpSize2, void *memOpAddr3, UINT32 memOpSize3)
+VOID PIN_FAST_ANALYSIS_CALL RecordPrefetch(Metrics *m, ADDRINT pc, ADDRINT ea, UINT32 size, UINT32 flags)
 {
-    RECORDMEM;
-    RECORDFOOTPRINT(memOpAddr1, memOpSize1, dataFootprint);
-    RECORDFOOTPRINT(memOpAddr2, memOpSize2, dataFootprint);
-    RECORDFOOTPRINT(memOpAddr3, memOpSize3, dataFootprint);
-    insMemTouched += memOpSize1 + memOpSize2 + memOpSize3;
-    if (memOpSize1 + memOpSize2 + memOpSize3 > insMemTouchedMax)
-        insMemTouchedMax = memOpSize1 + memOpSize2 + memOpSize3;
+    m->RecordPrefetch(pc, ea, size, flags);
 }
 
-VOID PredicatedAnalysisMetrics4Mem(PREDICATED_MEM_BASE_SIGNATURE, void *memOpAddr1, UINT32 memOpSize1, void *memOpAddr2, UINT32 memOpSize2, void *memOpAddr3, UINT32 memOpSize3, void *memOpAddr4, UINT32 memOpSize4)
+// -call_counts only, a run with extra calls that is not timed
+VOID CountCall(UINT32 kind)
 {
-    RECORDMEM;
-    RECORDFOOTPRINT(memOpAddr1, memOpSize1, dataFootprint);
-    RECORDFOOTPRINT(memOpAddr2, memOpSize2, dataFootprint);
-    RECORDFOOTPRINT(memOpAddr3, memOpSize3, dataFootprint);
-    RECORDFOOTPRINT(memOpAddr4, memOpSize4, dataFootprint);
-    insMemTouched += memOpSize1 + memOpSize2 + memOpSize3 + memOpSize4;
-    if (memOpSize1 + memOpSize2 + memOpSize3 + memOpSize4 > insMemTouchedMax)
-        insMemTouchedMax = memOpSize1 + memOpSize2 + memOpSize3 + memOpSize4;
+    __sync_fetch_and_add(&callCounts[kind], 1);
 }
 
-VOID PredicatedAnalysisMetrics5Mem(PREDICATED_MEM_BASE_SIGNATURE, void *memOpAddr1, UINT32 memOpSize1, void *memOpAddr2, UINT32 memOpSize2, void *memOpAddr3, UINT32 memOpSize3, void *memOpAddr4, UINT32 memOpSize4, void *memOpAddr5, UINT32 memOpSize5)
+// The per block fast path: straight line code on the budget register only, so
+// Pin inlines it. The register goes negative once the budget is spent.
+ADDRINT PIN_FAST_ANALYSIS_CALL DoInsCount(ADDRINT left, ADDRINT bblInsCount)
 {
-    RECORDMEM;
-    RECORDFOOTPRINT(memOpAddr1, memOpSize1, dataFootprint);
-    RECORDFOOTPRINT(memOpAddr2, memOpSize2, dataFootprint);
-    RECORDFOOTPRINT(memOpAddr3, memOpSize3, dataFootprint);
-    RECORDFOOTPRINT(memOpAddr4, memOpSize4, dataFootprint);
-    RECORDFOOTPRINT(memOpAddr5, memOpSize5, dataFootprint);
-    insMemTouched += memOpSize1 + memOpSize2 + memOpSize3 + memOpSize4 + memOpSize5;
-    if (memOpSize1 + memOpSize2 + memOpSize3 + memOpSize4 + memOpSize5 > insMemTouchedMax)
-        insMemTouchedMax = memOpSize1 + memOpSize2 + memOpSize3 + memOpSize4 + memOpSize5;
+    return left - bblInsCount;
 }
 
-VOID PredicatedAnalysisMetrics(UINT64 *insTypeAddr)
+ADDRINT PIN_FAST_ANALYSIS_CALL CheckFastForward(ADDRINT left)
 {
-    *insTypeAddr += 1;
-    insMemOperandsMap[0]++;
-    insMemReadMap[0]++;
-    insMemWriteMap[0]++;
+    return (ADDRDELTA)left <= 0;
 }
 
-VOID AnalysisMetrics(void *insAddr, UINT32 insSize, UINT32 operandsCount, UINT32 regReadCount, UINT32 regWriteCount, INT32 insImmediateMin, INT32 insImmediateMax)
+ADDRINT PIN_FAST_ANALYSIS_CALL CheckTerminate(ADDRINT left)
 {
-    RECORDFOOTPRINT(insAddr, insSize, insFootprint);
-    insLengthMap[insSize]++;
-    insOperandsMap[operandsCount]++;
-    insRegReadMap[regReadCount]++;
-    insRegWriteMap[regWriteCount]++;
-    if (insImmediateMin < immediateMin)
-        immediateMin = insImmediateMin;
-    if (insImmediateMax > immediateMax)
-        immediateMax = insImmediateMax;
+    return (ADDRDELTA)left <= 0;
 }
 
-VOID DoInsCount(UINT32 bblInsCount)
+// Only this thread and the window fold, which stops it first, touch the taken counts
+VOID PIN_FAST_ANALYSIS_CALL CountTaken(Metrics *m, UINT32 id)
 {
-    insCount += bblInsCount;
+    if (id >= m->blockTaken.size())
+        m->blockTaken.resize(2 * id + 1, 0);
+    m->blockTaken[id]++;
 }
 
-ADDRINT CheckFastForward(void)
+VOID PIN_FAST_ANALYSIS_CALL DoBblCount(Metrics *m, UINT32 id)
 {
-    return (insCount >= fastForward);
+    if (id >= m->bblExec.size())
+    {
+        // the progress thread reads the counts of running threads
+        PIN_GetLock(&metricsLock, m->tid + 1);
+        m->bblExec.resize(2 * id + 1, 0);
+        PIN_ReleaseLock(&metricsLock);
+    }
+    m->bblExec[id]++;
 }
 
-ADDRINT CheckTerminate(void)
+// Add this thread's pending instructions to the global count, returns the new total
+UINT64 SyncCount(Metrics *m)
 {
-    return (insCount >= fastForward + 1e9);
+    UINT64 total = __sync_add_and_fetch(&insCount, m->pending);
+    m->insCount += m->pending;
+    // the share of the window is taken from where the count lands in the global one
+    UINT64 from = std::max(total - m->pending, windowStart);
+    if (total > from)
+        m->windowIns += total - from;
+    m->pending = 0;
+    return total;
 }
 
-VOID Terminate(void)
+// Move what the budget register counted since the last SetBudget into pending
+inline VOID TakeBudget(Metrics *m, ADDRINT left)
 {
-    PIN_ExitApplication(0);
+    m->pending += (UINT64)((INT64)m->budget - (INT64)(ADDRDELTA)left);
+}
+
+// Let the thread run its share of the instructions left before the next window
+// boundary without touching the global count. With one thread this is exact.
+// Capped so that -progress sees the running threads' counts at least every
+// MAX_BUDGET instructions. Returns the new value of the budget register.
+#define MAX_BUDGET (1 << 24)
+ADDRINT SetBudget(Metrics *m)
+{
+    UINT64 boundary = detailPhase ? windowEnd : windowStart;
+    UINT64 total = insCount;
+    UINT32 threads = numLiveThreads > 0 ? numLiveThreads : 1;
+    m->budget = boundary > total ? (boundary - total) / threads : 0;
+    if (m->budget == 0)
+        m->budget = 1;
+    if (m->budget > MAX_BUDGET)
+        m->budget = MAX_BUDGET;
+    return (ADDRINT)m->budget;
+}
+
+// Take the counts of the threads stopped by PIN_StopApplicationThreads out of their registers
+VOID TakeStoppedBudgets(void)
+{
+    for (UINT32 i = 0; i < PIN_GetStoppedThreadCount(); i++)
+    {
+        CONTEXT *ctxt = PIN_GetStoppedThreadWriteableContext(i);
+        Metrics *m = (Metrics *)PIN_GetContextReg(ctxt, metricsReg);
+        if (m == 0)
+            continue;
+        TakeBudget(m, PIN_GetContextReg(ctxt, budgetReg));
+        PIN_SetContextReg(ctxt, budgetReg, (ADDRINT)m->budget);
+    }
+}
+
+ADDRINT StartDetail(Metrics *m, ADDRINT left, CONTEXT *ctxt)
+{
+    TakeBudget(m, left);
+    if (SyncCount(m) >= windowStart)
+    {
+        // drop the counting-only code and re-execute this block with full instrumentation
+        detailPhase = TRUE;
+        PIN_SetContextReg(ctxt, budgetReg, SetBudget(m));
+        PIN_RemoveInstrumentation();
+        PIN_ExecuteAt(ctxt);
+    }
+    return SetBudget(m);
+}
+
+VOID ReportWindow(void);
+
+VOID EndWindow(Metrics *m, THREADID tid, CONTEXT *ctxt)
+{
+    // another thread is already reporting this window
+    if (!__sync_bool_compare_and_swap(&windowBusy, 0, 1))
+        return;
+
+    // the other threads must not update their shards while they are merged and reset
+    BOOL stopped = numLiveThreads > 1 && PIN_StopApplicationThreads(tid);
+    if (stopped)
+        TakeStoppedBudgets();
+
+    // Fini reports the last window
+    if (windowIndex + 1 == numWindows)
+    {
+        if (stopped)
+            PIN_ResumeApplicationThreads(tid);
+        PIN_ExitApplication(0);
+    }
+
+    ReportWindow();
+    windowIndex++;
+    windowStart = fastForward + windowIndex * windowPeriod;
+    windowEnd = windowStart + windowLength;
+    BOOL skip = (insCount < windowStart);
+    if (skip)
+        detailPhase = FALSE;
+    if (stopped)
+        PIN_ResumeApplicationThreads(tid);
+    windowBusy = 0;
+
+    if (skip)
+    {
+        // skip to the next window with counting-only instrumentation
+        PIN_SetContextReg(ctxt, budgetReg, SetBudget(m));
+        PIN_RemoveInstrumentation();
+        PIN_ExecuteAt(ctxt);
+    }
+}
+
+ADDRINT Terminate(Metrics *m, ADDRINT left, THREADID tid, CONTEXT *ctxt)
+{
+    TakeBudget(m, left);
+    if (SyncCount(m) >= windowEnd)
+        EndWindow(m, tid, ctxt);
+    return SetBudget(m);
 }
 
 /* ===================================================================== */
 // Instrumentation callbacks
 /* ===================================================================== */
 
-#define MEM_ANALYSIS_ARGUMENTS IARG_PTR, instypeaddr, IARG_UINT32, numLoads, IARG_UINT32, numStores, \
-                               IARG_UINT32, readOperands, IARG_UINT32, writeOperands,                \
-                               IARG_ADDRINT, insDisplacementMax, IARG_ADDRINT, insDisplacementMin
+// -trace mode: one block record per executed block and one record per memory
+// operand, written into the thread's Pin buffer without any analysis call
+VOID InsertTraceBlock(BBL bbl)
+{
+    INS_InsertFillBuffer(BBL_InsHead(bbl), IPOINT_BEFORE, traceBuffer,
+                         IARG_INST_PTR, offsetof(TraceRecord, ip),
+                         IARG_ADDRINT, (ADDRINT)BBL_NumIns(bbl), offsetof(TraceRecord, ea),
+                         IARG_UINT32, (UINT32)BBL_Size(bbl), offsetof(TraceRecord, size),
+                         IARG_UINT32, (UINT32)TRACE_BLOCK, offsetof(TraceRecord, type), IARG_END);
+}
+
+// Instructions the block records do not fully describe are flagged, like the predicated analysis calls
+VOID InsertTraceIns(INS ins, UINT32 memOperands, BOOL summarize)
+{
+    if (!summarize && memOperands == 0)
+    {
+        INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, traceBuffer,
+                                       IARG_INST_PTR, offsetof(TraceRecord, ip),
+                                       IARG_UINT32, 0, offsetof(TraceRecord, size),
+                                       IARG_UINT32, (UINT32)TRACE_EXEC, offsetof(TraceRecord, type), IARG_END);
+        return;
+    }
+    for (UINT32 memOp = 0; memOp < memOperands; memOp++)
+    {
+        UINT32 type = (INS_MemoryOperandIsRead(ins, memOp) ? TRACE_READ : 0) | (INS_MemoryOperandIsWritten(ins, memOp) ? TRACE_WRITE : 0);
+        if (!summarize)
+            type |= TRACE_PREDICATED;
+        INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, traceBuffer,
+                                       IARG_INST_PTR, offsetof(TraceRecord, ip),
+                                       IARG_MEMORYOP_EA, memOp, offsetof(TraceRecord, ea),
+                                       IARG_MEMORYOP_SIZE, memOp, offsetof(TraceRecord, size),
+                                       IARG_UINT32, type, offsetof(TraceRecord, type), IARG_END);
+    }
+}
+
+// Hand a full buffer to the writer thread and continue with a free one
+VOID *TraceBufferFull(BUFFER_ID id, THREADID tid, const CONTEXT *ctxt, VOID *buf, UINT64 numElements, VOID *v)
+{
+    if (numElements == 0)
+        return buf;
+
+    PIN_GetLock(&traceLock, tid + 1);
+    // wait while the writer is too far behind, the queue would otherwise grow without bound
+    while (pendingBuffers.size() >= KnobTraceBuffers.Value() && !traceWriterExit)
+    {
+        PIN_ReleaseLock(&traceLock);
+        PIN_Sleep(1);
+        PIN_GetLock(&traceLock, tid + 1);
+    }
+    PendingBuffer pending = {tid, (TraceRecord *)buf, numElements};
+    pendingBuffers.push_back(pending);
+    TraceRecord *next = 0;
+    if (!freeBuffers.empty())
+    {
+        next = freeBuffers.back();
+        freeBuffers.pop_back();
+    }
+    PIN_ReleaseLock(&traceLock);
+
+    if (next == 0)
+        next = (TraceRecord *)PIN_AllocateBuffer(id);
+    return next;
+}
+
+// Compress and write the oldest full buffer, returns FALSE if there was none
+BOOL WriteTraceChunk(void)
+{
+    PIN_GetLock(&traceLock, 0);
+    if (pendingBuffers.empty())
+    {
+        PIN_ReleaseLock(&traceLock);
+        return FALSE;
+    }
+    PendingBuffer pending = pendingBuffers.front();
+    pendingBuffers.pop_front();
+    PIN_ReleaseLock(&traceLock);
+
+    std::ofstream *&file = traceFiles[pending.tid];
+    if (file == 0)
+    {
+        file = new std::ofstream((KnobTraceFile.Value() + "." + decstr(pending.tid) + ".hw1t").c_str(), std::ios::binary);
+        HW1TraceHeader header = {{'H', 'W', '1', 'T'}, HW1_TRACE_VERSION, pending.tid, traceFormat};
+        file->write((const char *)&header, sizeof(header));
+    }
+
+    traceEncoder.Begin();
+    for (UINT64 i = 0; i < pending.numRecords; i++)
+    {
+        const TraceRecord &record = pending.records[i];
+        if (traceFormat == TRACE_FORMAT_RAW)
+            traceEncoder.AddRaw(record.type, record.ip, record.ea, record.size);
+        else
+            traceEncoder.Add(record.type, record.ip, record.ea, record.size);
+    }
+    HW1TraceChunkHeader chunk = {(UINT32)traceEncoder.data.size(), traceEncoder.records};
+    file->write((const char *)&chunk, sizeof(chunk));
+    file->write((const char *)traceEncoder.data.data(), traceEncoder.data.size());
+    traceRecords += traceEncoder.records;
+    traceBytes += sizeof(chunk) + traceEncoder.data.size();
+
+    PIN_GetLock(&traceLock, 0);
+    freeBuffers.push_back(pending.records);
+    PIN_ReleaseLock(&traceLock);
+    return TRUE;
+}
+
+// Internal thread doing the compression and the file writes off the application threads
+VOID TraceWriter(VOID *arg)
+{
+    while (!traceWriterExit)
+        if (!WriteTraceChunk())
+            PIN_Sleep(1);
+}
+
+// Block records of the trace, for HW1Replay
+VOID WriteTraceStatic(void)
+{
+    std::ofstream file((KnobTraceFile.Value() + ".static.hw1t").c_str(), std::ios::binary);
+    HW1StaticHeader header = {{'H', 'W', '1', 'S'}, HW1_TRACE_VERSION, (UINT32)bblSummaries.size(),
+                              (UINT32)sizeof(ADDRINT) * 8, windowStart, windowIndex, 0};
+    file.write((const char *)&header, sizeof(header));
+    for (auto it = bblSummaries.begin(); it != bblSummaries.end(); it++)
+    {
+        HW1StaticBlock block = {it->first.first, it->first.second, (UINT32)it->second->ins.size()};
+        file.write((const char *)&block, sizeof(block));
+        file.write((const char *)it->second->ins.data(), block.numSummaries * sizeof(InsSummary));
+    }
+}
+
+VOID StopTraceWriter(VOID *v)
+{
+    traceWriterExit = TRUE;
+    INT32 exitCode;
+    PIN_WaitForThreadTermination(traceWriterUid, PIN_INFINITE_TIMEOUT, &exitCode);
+}
+
+// Routine id of the code at address, adding the routine on first sight. Called with metricsLock held.
+UINT32 RoutineId(ADDRINT address)
+{
+    RTN rtn = RTN_FindByAddress(address);
+    if (!RTN_Valid(rtn))
+        return 0;
+    UINT32 &id = routineIds[RTN_Address(rtn)];
+    if (id == 0)
+    {
+        RoutineInfo routine;
+        routine.name = PIN_UndecorateSymbolName(RTN_Name(rtn), UNDECORATION_NAME_ONLY);
+        routine.symbol = RTN_Name(rtn);
+        routine.address = RTN_Address(rtn);
+        routine.size = RTN_Size(rtn);
+        IMG img = IMG_FindByAddress(routine.address);
+        routine.image = IMG_Valid(img) ? IMG_Name(img) : "?";
+        routine.mainImage = IMG_Valid(img) && IMG_IsMainExecutable(img);
+        size_t slash = routine.image.find_last_of('/');
+        if (slash != string::npos)
+            routine.image = routine.image.substr(slash + 1);
+        id = routines.size();
+        routines.push_back(routine);
+    }
+    return id;
+}
+
+// How a block ends, for the edge profile of -layout
+UINT32 LayoutKind(INS tail)
+{
+    if (!INS_IsControlFlow(tail) || INS_IsSyscall(tail))
+        return LAYOUT_FALL;
+    if (!INS_IsDirectControlFlow(tail))
+        return LAYOUT_OTHER;
+    if (INS_IsCall(tail))
+        return LAYOUT_CALL;
+    return INS_Category(tail) == XED_CATEGORY_COND_BR ? LAYOUT_COND : LAYOUT_JUMP;
+}
+
+// Static part of the edge profile for a new block record. Called with metricsLock held.
+VOID LayoutProfileBlock(BBL bbl, UINT32 id, UINT32 routine)
+{
+    if (id >= layoutBlocks.size())
+        layoutBlocks.resize(2 * id + 1, LayoutBlock());
+    INS tail = BBL_InsTail(bbl);
+    LayoutBlock &block = layoutBlocks[id];
+    block.address = BBL_Address(bbl);
+    block.size = BBL_Size(bbl);
+    block.numIns = BBL_NumIns(bbl);
+    block.routine = routine;
+    block.kind = LayoutKind(tail);
+    block.target = INS_IsDirectControlFlow(tail) ? INS_DirectControlFlowTargetAddress(tail) : 0;
+    block.fallThrough = BBL_Address(bbl) + BBL_Size(bbl);
+}
+
+// Static part of the hot code profile for a new block record. Called with metricsLock held.
+VOID ProfileBlock(BBL bbl, UINT32 id)
+{
+    if (id >= blockRoutines.size())
+        blockRoutines.resize(2 * id + 1, 0);
+    UINT32 routine = RoutineId(BBL_Address(bbl));
+    blockRoutines[id] = routine;
+    if (layoutProfile)
+        LayoutProfileBlock(bbl, id, routine);
+    for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+    {
+        if (!INS_IsDirectBranch(ins))
+            continue;
+        ADDRINT target = INS_DirectControlFlowTargetAddress(ins);
+        if (target > INS_Address(ins) || (routine && target < routines[routine].address))
+            continue;
+        LoopInfo loop = {target, INS_Address(ins), routine};
+        loops[std::make_pair(target, INS_Address(ins))] = loop;
+    }
+}
+
+VOID InsertBblCallCount(BBL bbl, UINT32 kind)
+{
+    if (countCalls)
+        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)CountCall, IARG_UINT32, kind, IARG_END);
+}
+
+VOID InsertInsCallCount(INS ins, UINT32 kind, BOOL predicated)
+{
+    if (!countCalls)
+        return;
+    if (predicated)
+        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)CountCall, IARG_UINT32, kind, IARG_END);
+    else
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountCall, IARG_UINT32, kind, IARG_END);
+}
+
+// Feed the outcome of control flow instructions to the branch model
+VOID InsertBranchCalls(INS ins)
+{
+    switch (INS_Category(ins))
+    {
+    case XED_CATEGORY_COND_BR:
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)BranchConditional, IARG_FAST_ANALYSIS_CALL, IARG_REG_VALUE, metricsReg, IARG_INST_PTR, IARG_BRANCH_TAKEN, IARG_END);
+        break;
+    case XED_CATEGORY_UNCOND_BR:
+        if (!INS_IsIndirectControlFlow(ins))
+            return;
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)BranchIndirect, IARG_FAST_ANALYSIS_CALL, IARG_REG_VALUE, metricsReg, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_END);
+        break;
+    case XED_CATEGORY_CALL:
+        if (INS_IsDirectCall(ins))
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)BranchCall, IARG_FAST_ANALYSIS_CALL, IARG_REG_VALUE, metricsReg, IARG_ADDRINT, INS_NextAddress(ins), IARG_END);
+        else
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)BranchIndirectCall, IARG_FAST_ANALYSIS_CALL, IARG_REG_VALUE, metricsReg, IARG_INST_PTR,
+                           IARG_BRANCH_TARGET_ADDR, IARG_ADDRINT, INS_NextAddress(ins), IARG_END);
+        break;
+    case XED_CATEGORY_RET:
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)BranchReturn, IARG_FAST_ANALYSIS_CALL, IARG_REG_VALUE, metricsReg, IARG_BRANCH_TARGET_ADDR, IARG_END);
+        break;
+    default:
+        return;
+    }
+    InsertInsCallCount(ins, CALL_BRANCH, FALSE);
+}
+
+VOID InsertInsCount(BBL bbl)
+{
+    BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)DoInsCount, IARG_FAST_ANALYSIS_CALL, IARG_REG_VALUE, budgetReg,
+                   IARG_ADDRINT, (ADDRINT)BBL_NumIns(bbl), IARG_RETURN_REGS, budgetReg, IARG_END);
+    InsertBblCallCount(bbl, CALL_INS_COUNT);
+}
+
+// -timing: the full registers the instruction reads and writes, without the
+// instruction pointer that rip relative operands would otherwise chain on
+TimingIns MakeTimingIns(INS ins, UINT32 memOperands)
+{
+    TimingIns timing = {};
+    for (UINT32 i = 0; i < INS_MaxNumRRegs(ins) && timing.numReads < TIMING_MAX_REGS; i++)
+    {
+        REG reg = REG_FullRegName(INS_RegR(ins, i));
+        if (REG_valid(reg) && reg != REG_INST_PTR && (UINT32)reg < TIMING_REGS)
+            timing.regs[timing.numReads++] = (UINT16)reg;
+    }
+    for (UINT32 i = 0; i < INS_MaxNumWRegs(ins) && timing.numReads + timing.numWrites < TIMING_MAX_REGS; i++)
+    {
+        REG reg = REG_FullRegName(INS_RegW(ins, i));
+        if (REG_valid(reg) && reg != REG_INST_PTR && (UINT32)reg < TIMING_REGS)
+            timing.regs[timing.numReads + timing.numWrites++] = (UINT16)reg;
+    }
+    timing.memOperands = (UINT8)memOperands;
+    timing.memRead = INS_IsMemoryRead(ins);
+    return timing;
+}
+
+// -prefetch: every memory operand with its pc for the stride table. A load that
+// overwrites its own base register, like p = p->next, is a pointer chase candidate.
+VOID InsertPrefetchCalls(INS ins)
+{
+    REG base = INS_MemoryBaseReg(ins);
+    UINT32 chase = REG_valid(base) && base != REG_STACK_PTR && INS_RegWContain(ins, base) ? PREFETCH_CHASE : 0;
+    for (UINT32 memOp = 0; memOp < INS_MemoryOperandCount(ins); memOp++)
+    {
+        UINT32 flags = INS_MemoryOperandIsRead(ins, memOp) ? PREFETCH_READ | chase : 0;
+        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)RecordPrefetch, IARG_FAST_ANALYSIS_CALL, IARG_REG_VALUE, metricsReg,
+                                 IARG_INST_PTR, IARG_MEMORYOP_EA, memOp, IARG_MEMORYOP_SIZE, memOp, IARG_UINT32, flags, IARG_END);
+        InsertInsCallCount(ins, CALL_PREFETCH, TRUE);
+    }
+}
+
+#define MEM_ANALYSIS_ARGUMENTS IARG_REG_VALUE, metricsReg, IARG_UINT32, instypeoffset,              \
+                               IARG_UINT32, numLoads, IARG_UINT32, numStores,                     \
+                               IARG_UINT32, readOperands, IARG_UINT32, writeOperands,             \
+                               IARG_ADDRINT, insDisplacementMax, IARG_ADDRINT, insDisplacementMin, \
+                               IARG_UINT32, blockId
 
 VOID Trace(TRACE trace, VOID *v)
 {
+    ToolTimer timer(&instrumentNanos);
+    // Fast forward phase: only count instructions until the window starts
+    if (!detailPhase)
+    {
+        for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+        {
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)CheckFastForward, IARG_FAST_ANALYSIS_CALL, IARG_REG_VALUE, budgetReg, IARG_END);
+            BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)StartDetail, IARG_REG_VALUE, metricsReg, IARG_REG_VALUE, budgetReg,
+                               IARG_CONTEXT, IARG_RETURN_REGS, budgetReg, IARG_END);
+            InsertBblCallCount(bbl, CALL_CHECK_FAST_FORWARD);
+            InsertInsCount(bbl);
+        }
+        return;
+    }
+
     // Visit every basic block in the trace
     for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
     {
+        // block record for BBL summary mode, shared by every copy of the same block.
+        // -trace mode always builds them, the replay folds its block records into them.
+        BblSummary *summary = 0;
+        BOOL fillSummary = FALSE;
+        if (KnobBblSummary.Value() || traceMode)
+        {
+            PIN_GetLock(&metricsLock, 0);
+            BblSummary *&entry = bblSummaries[std::make_pair(BBL_Address(bbl), BBL_NumIns(bbl))];
+            fillSummary = (entry == 0);
+            if (fillSummary)
+            {
+                entry = new BblSummary();
+                entry->id = bblSummaries.size();
+                entry->numIns = BBL_NumIns(bbl);
+                if (hotCode || layoutProfile)
+                    ProfileBlock(bbl, entry->id);
+            }
+            summary = entry;
+            PIN_ReleaseLock(&metricsLock);
+        }
+        UINT32 blockId = summary ? summary->id : 0;
+        if (traceMode)
+            InsertTraceBlock(bbl);
+        // ahead of the data accesses of the block's first instruction, which queue their latencies,
+        // and after the window check
+        if (summary && timingModel)
+        {
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)TimeBlock, IARG_FAST_ANALYSIS_CALL, IARG_CALL_ORDER, CALL_ORDER_FIRST + 1,
+                           IARG_REG_VALUE, metricsReg, IARG_PTR, summary, IARG_END);
+            InsertBblCallCount(bbl, CALL_TIME_BLOCK);
+        }
+
         // loop over all instructions in the basic block
         for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
         {
             if (INS_Category(ins) == XED_CATEGORY_INVALID)
                 continue;
 
-            // type A pointer to increment in instruction metrics stucture
-            void *instypeaddr = 0;
+            // type A counter to increment, as offset into the instruction metrics stucture
+            UINT32 instypeoffset = 0;
             // type B: number of loads
             UINT32 numLoads = 0;
             // type B: number of stores
@@ -249,11 +1038,15 @@ VOID Trace(TRACE trace, VOID *v)
             UINT32 memOperands = INS_MemoryOperandCount(ins);
             UINT32 readOperands = 0;
             UINT32 writeOperands = 0;
-            ADDRDELTA insDisplacementMax = INT32_MIN, insDisplacementMin = INT32_MAX, displacementValue;
+            UINT32 memTouched = 0;
+            // full width on intel64, the casts sign extend 32-bit values on ia32
+            ADDRDELTA insDisplacementMax = std::numeric_limits<ADDRDELTA>::min(), insDisplacementMin = std::numeric_limits<ADDRDELTA>::max(),
+                      displacementValue;
 
             for (UINT32 memOp = 0; memOp < memOperands; memOp++)
             {
                 dataSize = INS_MemoryOperandSize(ins, memOp);
+                memTouched += dataSize;
                 if (INS_MemoryOperandIsRead(ins, memOp))
                 {
                     numLoads += dataSize / granularity + (dataSize % granularity != 0);
@@ -264,7 +1057,7 @@ VOID Trace(TRACE trace, VOID *v)
                     numStores += dataSize / granularity + (dataSize % granularity != 0);
                     writeOperands++;
                 }
-                displacementValue = INS_OperandMemoryDisplacement(ins, memOp);
+                displacementValue = INS_OperandMemoryDisplacement(ins, INS_MemoryOperandIndexToOperandIndex(ins, memOp));
                 if (displacementValue > insDisplacementMax)
                     insDisplacementMax = displacementValue;
                 if (displacementValue < insDisplacementMin)
@@ -274,65 +1067,66 @@ VOID Trace(TRACE trace, VOID *v)
             switch (INS_Category(ins))
             {
             case XED_CATEGORY_NOP:
-                instypeaddr = &instMetrics->numNops;
+                instypeoffset = offsetof(InstMetrics, numNops);
                 break;
             case XED_CATEGORY_CALL:
                 if (INS_IsDirectCall(ins))
-                    instypeaddr = &instMetrics->numDirectCalls;
+                    instypeoffset = offsetof(InstMetrics, numDirectCalls);
                 else
-                    instypeaddr = &instMetrics->numIndirectCalls;
+                    instypeoffset = offsetof(InstMetrics, numIndirectCalls);
                 break;
             case XED_CATEGORY_RET:
-                instypeaddr = &instMetrics->numReturns;
+                instypeoffset = offsetof(InstMetrics, numReturns);
                 break;
             case XED_CATEGORY_UNCOND_BR:
-                instypeaddr = &instMetrics->numUncondBranches;
+                instypeoffset = offsetof(InstMetrics, numUncondBranches);
                 break;
             case XED_CATEGORY_COND_BR:
-                instypeaddr = &instMetrics->numCondBranches;
+                instypeoffset = offsetof(InstMetrics, numCondBranches);
                 break;
             case XED_CATEGORY_LOGICAL:
-                instypeaddr = &instMetrics->numLogicalOps;
+                instypeoffset = offsetof(InstMetrics, numLogicalOps);
                 break;
             case XED_CATEGORY_ROTATE:
             case XED_CATEGORY_SHIFT:
-                instypeaddr = &instMetrics->numRotateShift;
+                instypeoffset = offsetof(InstMetrics, numRotateShift);
                 break;
             case XED_CATEGORY_FLAGOP:
-                instypeaddr = &instMetrics->numFlagOps;
+                instypeoffset = offsetof(InstMetrics, numFlagOps);
                 break;
             case XED_CATEGORY_AVX:
             case XED_CATEGORY_AVX2:
             case XED_CATEGORY_AVX2GATHER:
             case XED_CATEGORY_AVX512:
-                instypeaddr = &instMetrics->numVector;
+                instypeoffset = offsetof(InstMetrics, numVector);
                 break;
             case XED_CATEGORY_CMOV:
-                instypeaddr = &instMetrics->numCondMoves;
+                instypeoffset = offsetof(InstMetrics, numCondMoves);
                 break;
             case XED_CATEGORY_MMX:
             case XED_CATEGORY_SSE:
-                instypeaddr = &instMetrics->numMMXSSE;
+                instypeoffset = offsetof(InstMetrics, numMMXSSE);
                 break;
             case XED_CATEGORY_SYSCALL:
-                instypeaddr = &instMetrics->numSysCalls;
+                instypeoffset = offsetof(InstMetrics, numSysCalls);
                 break;
             case XED_CATEGORY_X87_ALU:
-                instypeaddr = &instMetrics->numFP;
+                instypeoffset = offsetof(InstMetrics, numFP);
                 break;
             default:
-                instypeaddr = &instMetrics->numRest;
+                instypeoffset = offsetof(InstMetrics, numRest);
                 break;
             }
 
             UINT32 numOperand = INS_OperandCount(ins);
-            INT32 insImmediateMin = INT32_MAX, insImmediateMax = INT32_MIN, immediateValue;
+            ADDRDELTA insImmediateMin = std::numeric_limits<ADDRDELTA>::max(), insImmediateMax = std::numeric_limits<ADDRDELTA>::min(),
+                      immediateValue;
 
             for (UINT32 i = 0; i < numOperand; i++)
             {
                 if (INS_OperandIsImmediate(ins, i))
                 {
-                    immediateValue = (INT32)INS_OperandImmediate(ins, i);
+                    immediateValue = (ADDRDELTA)INS_OperandImmediate(ins, i);
                     if (immediateValue < insImmediateMin)
                         insImmediateMin = immediateValue;
                     if (immediateValue > insImmediateMax)
@@ -340,212 +1134,890 @@ VOID Trace(TRACE trace, VOID *v)
                 }
             }
 
-            INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)CheckFastForward, IARG_END);
-            switch (memOperands)
+            // predicated instructions and ones the fallback handles specially stay per instruction
+            BOOL summarize = (summary != 0) && !INS_IsPredicated(ins);
+            if (fillSummary)
             {
-            case 0:
-                INS_InsertThenPredicatedCall(
-                    ins, IPOINT_BEFORE, (AFUNPTR)PredicatedAnalysisMetrics,
-                    IARG_PTR, instypeaddr, IARG_END);
-                break;
-            case 1:
-                INS_InsertThenPredicatedCall(
-                    ins, IPOINT_BEFORE, (AFUNPTR)PredicatedAnalysisMetrics1Mem,
-                    MEM_ANALYSIS_ARGUMENTS,
-                    IARG_MEMORYOP_EA, 0, IARG_MEMORYOP_SIZE, 0, IARG_END);
-                break;
-            case 2:
-                INS_InsertThenPredicatedCall(
-                    ins, IPOINT_BEFORE, (AFUNPTR)PredicatedAnalysisMetrics2Mem,
-                    MEM_ANALYSIS_ARGUMENTS,
-                    IARG_MEMORYOP_EA, 0, IARG_MEMORYOP_SIZE, 0,
-                    IARG_MEMORYOP_EA, 1, IARG_MEMORYOP_SIZE, 1, IARG_END);
-                break;
-            case 3:
-                INS_InsertThenPredicatedCall(
-                    ins, IPOINT_BEFORE, (AFUNPTR)PredicatedAnalysisMetrics3Mem,
-                    MEM_ANALYSIS_ARGUMENTS,
-                    IARG_MEMORYOP_EA, 0, IARG_MEMORYOP_SIZE, 0,
-                    IARG_MEMORYOP_EA, 1, IARG_MEMORYOP_SIZE, 1,
-                    IARG_MEMORYOP_EA, 2, IARG_MEMORYOP_SIZE, 2, IARG_END);
-                break;
-            case 4:
-                INS_InsertThenPredicatedCall(
-                    ins, IPOINT_BEFORE, (AFUNPTR)PredicatedAnalysisMetrics4Mem,
-                    MEM_ANALYSIS_ARGUMENTS,
-                    IARG_MEMORYOP_EA, 0, IARG_MEMORYOP_SIZE, 0,
-                    IARG_MEMORYOP_EA, 1, IARG_MEMORYOP_SIZE, 1,
-                    IARG_MEMORYOP_EA, 2, IARG_MEMORYOP_SIZE, 2,
-                    IARG_MEMORYOP_EA, 3, IARG_MEMORYOP_SIZE, 3, IARG_END);
-                break;
-            case 5:
-                INS_InsertThenPredicatedCall(
-                    ins, IPOINT_BEFORE, (AFUNPTR)PredicatedAnalysisMetrics5Mem,
-                    MEM_ANALYSIS_ARGUMENTS,
-                    IARG_MEMORYOP_EA, 0, IARG_MEMORYOP_SIZE, 0,
-                    IARG_MEMORYOP_EA, 1, IARG_MEMORYOP_SIZE, 1,
-                    IARG_MEMORYOP_EA, 2, IARG_MEMORYOP_SIZE, 2,
-                    IARG_MEMORYOP_EA, 3, IARG_MEMORYOP_SIZE, 3,
-                    IARG_MEMORYOP_EA, 4, IARG_MEMORYOP_SIZE, 4, IARG_END);
-                break;
-            default:
-                *out << "ERROR: more than 5 memory operands" << endl;
-                *out << "ERROR: " << INS_Disassemble(ins) << endl;
-                INS_InsertThenPredicatedCall(
-                    ins, IPOINT_BEFORE, (AFUNPTR)PredicatedAnalysisMetrics,
-                    IARG_PTR, instypeaddr, IARG_END); // to prevent pin error
-                break;
+                InsSummary insSummary;
+                insSummary.insAddr = INS_Address(ins);
+                insSummary.insSize = INS_Size(ins);
+                insSummary.operandsCount = INS_OperandCount(ins);
+                insSummary.regReadCount = INS_MaxNumRRegs(ins);
+                insSummary.regWriteCount = INS_MaxNumWRegs(ins);
+                insSummary.immediateMin = insImmediateMin;
+                insSummary.immediateMax = insImmediateMax;
+                insSummary.predicated = !summarize;
+                insSummary.insTypeOffset = instypeoffset;
+                insSummary.memOperands = memOperands;
+                insSummary.numLoads = numLoads;
+                insSummary.numStores = numStores;
+                insSummary.readOperands = readOperands;
+                insSummary.writeOperands = writeOperands;
+                insSummary.memTouched = memTouched;
+                insSummary.displacementMax = insDisplacementMax;
+                insSummary.displacementMin = insDisplacementMin;
+                summary->ins.push_back(insSummary);
+                if (timingModel)
+                    summary->timing.push_back(MakeTimingIns(ins, memOperands));
             }
 
-            INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)CheckFastForward, IARG_END);
-            INS_InsertThenCall(
-                ins, IPOINT_BEFORE, (AFUNPTR)AnalysisMetrics,
-                IARG_INST_PTR, IARG_UINT32, INS_Size(ins),
-                IARG_UINT32, INS_OperandCount(ins),
-                IARG_UINT32, INS_MaxNumRRegs(ins),
-                IARG_UINT32, INS_MaxNumWRegs(ins),
-                IARG_ADDRINT, insImmediateMin,
-                IARG_ADDRINT, insImmediateMax,
-                IARG_END);
+            if (traceMode)
+            {
+                InsertTraceIns(ins, memOperands, summarize);
+                continue;
+            }
+
+            if (branchModel)
+                InsertBranchCalls(ins);
+            if (prefetchModel)
+                InsertPrefetchCalls(ins);
+
+            if (summarize)
+            {
+                // only the footprint, the caches and the TLBs depend on the effective address
+                if (metricMask & (METRIC_FOOTPRINT | METRIC_CACHE | METRIC_TLB))
+                    for (UINT32 memOp = 0; memOp < memOperands; memOp++)
+                    {
+                        INS_InsertCall(
+                            ins, IPOINT_BEFORE, analysisRoutines.dataAccess,
+                            IARG_REG_VALUE, metricsReg, IARG_MEMORYOP_EA, memOp, IARG_MEMORYOP_SIZE, memOp, IARG_UINT32, blockId, IARG_END);
+                        InsertInsCallCount(ins, CALL_DATA_ACCESS, FALSE);
+                    }
+            }
+            else if (memOperands == 0)
+            {
+                if (metricMask & (METRIC_MIX | METRIC_PARTD))
+                {
+                    INS_InsertPredicatedCall(
+                        ins, IPOINT_BEFORE, analysisRoutines.predicated,
+                        IARG_REG_VALUE, metricsReg, IARG_UINT32, instypeoffset, IARG_END);
+                    InsertInsCallCount(ins, CALL_PREDICATED, TRUE);
+                }
+            }
+            else if (metricMask)
+            {
+                UINT32 packed = memOperands < PACKED_MEM_OPERANDS ? memOperands : PACKED_MEM_OPERANDS;
+                IARGLIST operands = IARGLIST_Alloc();
+                for (UINT32 memOp = 0; memOp < packed; memOp++)
+                    IARGLIST_AddArguments(operands, IARG_MEMORYOP_EA, memOp, IARG_MEMORYOP_SIZE, memOp, IARG_END);
+                INS_InsertPredicatedCall(
+                    ins, IPOINT_BEFORE, analysisRoutines.predicatedMem[packed - 1],
+                    MEM_ANALYSIS_ARGUMENTS, IARG_UINT32, memTouched, IARG_IARGLIST, operands, IARG_END);
+                IARGLIST_Free(operands);
+                InsertInsCallCount(ins, CALL_PREDICATED_MEM + packed - 1, TRUE);
+                for (UINT32 memOp = packed; memOp < memOperands; memOp++)
+                {
+                    INS_InsertPredicatedCall(
+                        ins, IPOINT_BEFORE, analysisRoutines.dataAccess,
+                        IARG_REG_VALUE, metricsReg, IARG_MEMORYOP_EA, memOp, IARG_MEMORYOP_SIZE, memOp, IARG_UINT32, blockId, IARG_END);
+                    InsertInsCallCount(ins, CALL_DATA_ACCESS, TRUE);
+                }
+            }
+
+            if (summary == 0 && (metricMask & (METRIC_FOOTPRINT | METRIC_PARTD)))
+            {
+                INS_InsertCall(
+                    ins, IPOINT_BEFORE, analysisRoutines.analysisMetrics,
+                    IARG_REG_VALUE, metricsReg, IARG_INST_PTR, IARG_UINT32, INS_Size(ins),
+                    IARG_UINT32, INS_OperandCount(ins),
+                    IARG_UINT32, INS_MaxNumRRegs(ins),
+                    IARG_UINT32, INS_MaxNumWRegs(ins),
+                    IARG_ADDRINT, insImmediateMin,
+                    IARG_ADDRINT, insImmediateMax,
+                    IARG_END);
+                InsertInsCallCount(ins, CALL_ANALYSIS_METRICS, FALSE);
+            }
+        }
+        // ahead of every other call of the block, which then counts wholly in the next window
+        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)CheckTerminate, IARG_FAST_ANALYSIS_CALL, IARG_CALL_ORDER, CALL_ORDER_FIRST,
+                         IARG_REG_VALUE, budgetReg, IARG_END);
+        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)Terminate, IARG_CALL_ORDER, CALL_ORDER_FIRST, IARG_REG_VALUE, metricsReg,
+                           IARG_REG_VALUE, budgetReg, IARG_THREAD_ID, IARG_CONTEXT, IARG_RETURN_REGS, budgetReg, IARG_END);
+        InsertBblCallCount(bbl, CALL_CHECK_TERMINATE);
+
+        // instruction fetch goes through the L1I and the ITLB once per block
+        if ((cacheModel || tlbModel) && !traceMode)
+        {
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)FetchBbl, IARG_FAST_ANALYSIS_CALL, IARG_REG_VALUE, metricsReg, IARG_INST_PTR, IARG_UINT32, BBL_Size(bbl), IARG_END);
+            InsertBblCallCount(bbl, CALL_FETCH);
+        }
+
+        if (summary && !traceMode)
+        {
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)DoBblCount, IARG_FAST_ANALYSIS_CALL, IARG_REG_VALUE, metricsReg,
+                           IARG_UINT32, summary->id, IARG_END);
+            InsertBblCallCount(bbl, CALL_BBL_COUNT);
+        }
+        // the fall through count of a conditional branch is the block's executions minus this
+        if (summary && layoutProfile && LayoutKind(BBL_InsTail(bbl)) == LAYOUT_COND)
+        {
+            INS_InsertCall(BBL_InsTail(bbl), IPOINT_TAKEN_BRANCH, (AFUNPTR)CountTaken, IARG_FAST_ANALYSIS_CALL, IARG_REG_VALUE, metricsReg,
+                           IARG_UINT32, summary->id, IARG_END);
+            InsertInsCallCount(BBL_InsTail(bbl), CALL_TAKEN, FALSE);
+        }
+        InsertInsCount(bbl);
+    }
+}
+
+// Add execution count times every block record into the thread's metrics and reset the counts.
+// Called with metricsLock held.
+VOID FoldBblSummaries(Metrics *m)
+{
+    for (auto it = bblSummaries.begin(); it != bblSummaries.end(); it++)
+    {
+        BblSummary *summary = it->second;
+        if (summary->id >= m->bblExec.size())
+            continue;
+        UINT64 n = m->bblExec[summary->id];
+        if (n == 0)
+            continue;
+        if (collectBbv)
+        {
+            if (summary->id >= bbvCounts.size())
+                bbvCounts.resize(bblSummaries.size() + 1, 0);
+            bbvCounts[summary->id] += n;
+        }
+        if (hotCode || layoutProfile)
+        {
+            if (summary->id >= blockTotals.size())
+                blockTotals.resize(bblSummaries.size() + 1, 0);
+            blockTotals[summary->id] += n;
+        }
+        m->FoldBlock(summary, n);
+        m->bblExec[summary->id] = 0;
+    }
+    if (m->blockTaken.size() > blockTaken.size())
+        blockTaken.resize(m->blockTaken.size(), 0);
+    for (size_t id = 0; id < m->blockTaken.size(); id++)
+    {
+        blockTaken[id] += m->blockTaken[id];
+        m->blockTaken[id] = 0;
+    }
+    if (m->blockDataTouches.size() > blockTouches.size())
+        blockTouches.resize(m->blockDataTouches.size(), 0);
+    for (size_t id = 0; id < m->blockDataTouches.size(); id++)
+    {
+        blockTouches[id] += m->blockDataTouches[id];
+        m->blockDataTouches[id] = 0;
+    }
+}
+
+// One line per block executed in the window, SimPoint weights blocks by their instructions
+VOID WriteBbv(void)
+{
+    if (bbvOut)
+        *bbvOut << "T";
+    for (auto it = bblSummaries.begin(); it != bblSummaries.end(); it++)
+    {
+        BblSummary *summary = it->second;
+        if (summary->id >= bbvCounts.size() || bbvCounts[summary->id] == 0)
+            continue;
+        if (bbvOut)
+            *bbvOut << ":" << summary->id << ":" << bbvCounts[summary->id] * summary->numIns << " ";
+        if (bbvTable)
+        {
+            bbvTable->Put(windowIndex);
+            bbvTable->Put(summary->id);
+            bbvTable->Put(bbvCounts[summary->id] * summary->numIns);
+        }
+    }
+    if (bbvOut)
+        *bbvOut << endl;
+    std::fill(bbvCounts.begin(), bbvCounts.end(), 0);
+}
+
+ThreadReport MakeThreadReport(const Metrics *m)
+{
+    ThreadReport report;
+    report.tid = m->tid;
+    report.insCount = m->windowIns + m->pending;
+    report.instMetrics = m->instMetrics;
+    report.dataBlocks = m->dataFootprint.Size();
+    report.insBlocks = m->insFootprint.Size();
+    return report;
+}
+
+// Window description for the report in HW1Core.h
+ReportInfo MakeReportInfo(void)
+{
+    ReportInfo info;
+    info.outputFile = KnobOutputFile.Value();
+    info.insCount = insCount;
+    info.windowStart = windowStart;
+    info.windowIndex = windowIndex;
+    info.numWindows = numWindows;
+    info.cacheConfigs = cacheModel ? cacheConfigs : 0;
+    info.cachePolicy = KnobCachePolicy.Value();
+    info.memLatency = KnobMemLatency.Value();
+    info.branchPredictors = branchModel ? branchPredictors : 0;
+    info.numBranchPredictors = numBranchPredictors;
+    info.branchPenalty = KnobBranchPenalty.Value();
+    info.prefetchDegree = prefetchModel ? KnobPrefetchDegree.Value() : 0;
+    info.robSize = timingModel ? KnobRobSize.Value() : 0;
+    info.issueWidth = KnobIssueWidth.Value();
+    info.tlbConfigs = tlbModel ? tlbConfigs : 0;
+    info.pageWalk = KnobPageWalk.Value();
+    info.reuseRate = KnobReuse.Value() && (metricMask & METRIC_FOOTPRINT) ? 1.0 / KnobReuseSample.Value() : 0;
+    info.reuseInterval = KnobReuseInterval.Value();
+    info.metrics = metricMask;
+    info.addressBits = sizeof(ADDRINT) * 8;
+    info.startTime = startTime;
+    return info;
+}
+
+// The metrics are not computed in -trace mode, only the window and what was written so far
+VOID PrintTraceResults(void)
+{
+    *out << "===============================================" << endl;
+    *out << "HW1 trace capture from " << KnobOutputFile.Value() << endl;
+    *out << "Number of instructions: " << insCount << endl;
+    *out << "Fast forward at:        " << windowStart << endl;
+    *out << "Number of instructions after fast forward: " << insCount - windowStart << endl;
+    if (numWindows > 1)
+        *out << "Window:                 " << windowIndex + 1 << " of " << numWindows << endl;
+    *out << "Trace files:            " << KnobTraceFile.Value() << ".<tid>.hw1t" << endl;
+    *out << "Records written:        " << traceRecords << endl;
+    *out << "Bytes written:          " << traceBytes << endl;
+    if (traceRecords)
+        *out << "Bytes per record:       " << std::fixed << std::setprecision(2) << traceBytes * 1.0 / traceRecords << endl;
+}
+
+VOID PrintThreadReports(void)
+{
+    *out << "\n====================THREADS====================" << endl;
+    *out << std::setw(8) << std::left << "Thread" << std::setw(16) << "Instructions" << std::setw(14) << "Loads"
+         << std::setw(14) << "Stores" << std::setw(14) << "Data regions" << "Ins regions" << endl;
+    for (auto it = threadReports.begin(); it != threadReports.end(); it++)
+        *out << std::setw(8) << std::left << it->tid << std::setw(16) << it->insCount << std::setw(14) << it->instMetrics.numLoads
+             << std::setw(14) << it->instMetrics.numStores << std::setw(14) << it->dataBlocks << it->insBlocks << endl;
+}
+
+template <UINT32 N>
+VOID PutHistogram(HW1ResultTable *table, const Histogram<N> &hist)
+{
+    for (UINT32 i = 0; i <= N; i++)
+        table->Put(hist.bucket[i]);
+}
+
+// One row per window and one per thread for the binary results
+VOID AddResultRows(const Metrics *m)
+{
+    windowTable->Put(windowIndex);
+    windowTable->Put(windowStart);
+    windowTable->Put(insCount);
+    windowTable->Put(numThreads);
+    for (UINT32 i = 0; i < INST_METRICS_COUNTERS; i++)
+        windowTable->Put(((const UINT64 *)&m->instMetrics)[i]);
+    windowTable->PutF64(FlatCpi(m->instMetrics, InstMetricsTotal(m->instMetrics)));
+    for (UINT32 i = 0; i < CACHE_LEVELS; i++)
+    {
+        windowTable->Put(m->caches.level[i].accesses);
+        windowTable->Put(m->caches.level[i].misses);
+    }
+    windowTable->PutF64(CacheCpi(m->caches, InstMetricsTotal(m->instMetrics)));
+    windowTable->Put(m->branches.condBranches);
+    for (UINT32 i = 0; i < numBranchPredictors; i++)
+        windowTable->Put(m->branches.condMisses[i]);
+    windowTable->Put(m->branches.indirectMisses);
+    windowTable->Put(m->branches.returnMisses);
+    windowTable->PutF64(ModelCpi(m, InstMetricsTotal(m->instMetrics), KnobBranchPenalty.Value()));
+    windowTable->Put(m->dataFootprint.Size());
+    windowTable->Put(m->insFootprint.Size());
+    windowTable->PutF64(m->reuse.cold);
+    for (UINT32 i = 0; i < REUSE_BUCKETS; i++)
+        windowTable->PutF64(m->reuse.bucket[i]);
+    PutHistogram(windowTable, m->insLengthHist);
+    PutHistogram(windowTable, m->insOperandsHist);
+    PutHistogram(windowTable, m->insRegReadHist);
+    PutHistogram(windowTable, m->insRegWriteHist);
+    PutHistogram(windowTable, m->insMemOperandsHist);
+    PutHistogram(windowTable, m->insMemReadHist);
+    PutHistogram(windowTable, m->insMemWriteHist);
+    windowTable->Put(m->insMemTouched);
+    windowTable->Put(m->insMemTouchedMax);
+    windowTable->PutI64(m->immediateMax);
+    windowTable->PutI64(m->immediateMin);
+    windowTable->PutI64(m->displacementMax);
+    windowTable->PutI64(m->displacementMin);
+
+    for (auto it = threadReports.begin(); it != threadReports.end(); it++)
+    {
+        threadTable->Put(windowIndex);
+        threadTable->Put(it->tid);
+        threadTable->Put(it->insCount);
+        threadTable->Put(it->instMetrics.numLoads);
+        threadTable->Put(it->instMetrics.numStores);
+        threadTable->Put(it->dataBlocks);
+        threadTable->Put(it->insBlocks);
+    }
+}
+
+VOID SetupResultTables(void)
+{
+    resultWriter = new HW1ResultWriter();
+
+    windowTable = resultWriter->AddTable("windows");
+    windowTable->AddColumn("window", HW1_COLUMN_U64);
+    windowTable->AddColumn("start", HW1_COLUMN_U64);
+    windowTable->AddColumn("end", HW1_COLUMN_U64);
+    windowTable->AddColumn("threads", HW1_COLUMN_U64);
+    for (UINT32 i = 0; i < INST_METRICS_COUNTERS; i++)
+        windowTable->AddColumn(instMetricsNames[i], HW1_COLUMN_U64);
+    windowTable->AddColumn("cpi", HW1_COLUMN_F64);
+    for (UINT32 i = 0; i < CACHE_LEVELS; i++)
+    {
+        string level = cacheLevelNames[i];
+        std::transform(level.begin(), level.end(), level.begin(), ::tolower);
+        windowTable->AddColumn(level + "_accesses", HW1_COLUMN_U64);
+        windowTable->AddColumn(level + "_misses", HW1_COLUMN_U64);
+    }
+    windowTable->AddColumn("cache_cpi", HW1_COLUMN_F64);
+    windowTable->AddColumn("cond_branches", HW1_COLUMN_U64);
+    for (UINT32 i = 0; i < numBranchPredictors; i++)
+        windowTable->AddColumn(string(branchPredictorNames[branchPredictors[i]]) + "_misses", HW1_COLUMN_U64);
+    windowTable->AddColumn("btb_misses", HW1_COLUMN_U64);
+    windowTable->AddColumn("ras_misses", HW1_COLUMN_U64);
+    windowTable->AddColumn("model_cpi", HW1_COLUMN_F64);
+    windowTable->AddColumn("data_regions", HW1_COLUMN_U64);
+    windowTable->AddColumn("ins_regions", HW1_COLUMN_U64);
+    windowTable->AddColumn("reuse_cold", HW1_COLUMN_F64);
+    windowTable->AddColumn("reuse_distance", HW1_COLUMN_F64, REUSE_BUCKETS);
+    windowTable->AddColumn("d1_length", HW1_COLUMN_U64, 16 + 1);
+    windowTable->AddColumn("d2_operands", HW1_COLUMN_U64, HIST_BUCKETS + 1);
+    windowTable->AddColumn("d3_reg_read", HW1_COLUMN_U64, HIST_BUCKETS + 1);
+    windowTable->AddColumn("d4_reg_write", HW1_COLUMN_U64, HIST_BUCKETS + 1);
+    windowTable->AddColumn("d5_mem_operands", HW1_COLUMN_U64, HIST_BUCKETS + 1);
+    windowTable->AddColumn("d6_mem_read", HW1_COLUMN_U64, HIST_BUCKETS + 1);
+    windowTable->AddColumn("d7_mem_write", HW1_COLUMN_U64, HIST_BUCKETS + 1);
+    windowTable->AddColumn("mem_touched", HW1_COLUMN_U64);
+    windowTable->AddColumn("mem_touched_max", HW1_COLUMN_U64);
+    windowTable->AddColumn("immediate_max", HW1_COLUMN_I64);
+    windowTable->AddColumn("immediate_min", HW1_COLUMN_I64);
+    windowTable->AddColumn("displacement_max", HW1_COLUMN_I64);
+    windowTable->AddColumn("displacement_min", HW1_COLUMN_I64);
+
+    threadTable = resultWriter->AddTable("threads");
+    threadTable->AddColumn("window", HW1_COLUMN_U64);
+    threadTable->AddColumn("tid", HW1_COLUMN_U64);
+    threadTable->AddColumn("instructions", HW1_COLUMN_U64);
+    threadTable->AddColumn("loads", HW1_COLUMN_U64);
+    threadTable->AddColumn("stores", HW1_COLUMN_U64);
+    threadTable->AddColumn("data_regions", HW1_COLUMN_U64);
+    threadTable->AddColumn("ins_regions", HW1_COLUMN_U64);
+
+    // the vectors and block table come from the basic block records
+    if (!KnobBblSummary.Value())
+        return;
+    bbvTable = resultWriter->AddTable("bbv");
+    bbvTable->AddColumn("window", HW1_COLUMN_U64);
+    bbvTable->AddColumn("block", HW1_COLUMN_U64);
+    bbvTable->AddColumn("weight", HW1_COLUMN_U64);
+
+    blockTable = resultWriter->AddTable("blocks");
+    blockTable->AddColumn("block", HW1_COLUMN_U64);
+    blockTable->AddColumn("address", HW1_COLUMN_U64);
+    blockTable->AddColumn("instructions", HW1_COLUMN_U64);
+}
+
+VOID WriteResultFile(void)
+{
+    if (blockTable)
+        for (auto it = bblSummaries.begin(); it != bblSummaries.end(); it++)
+        {
+            blockTable->Put(it->second->id);
+            blockTable->Put(it->first.first);
+            blockTable->Put(it->second->numIns);
+        }
+    if (!resultWriter->Write(KnobResultFile.Value()))
+        cerr << "ERROR: could not write " << KnobResultFile.Value() << endl;
+}
+
+// Fold and merge every shard, print the window and start the shards over.
+// The other application threads must be stopped or gone.
+VOID ReportWindow(void)
+{
+    ToolTimer timer(&reportNanos);
+    PIN_GetLock(&metricsLock, 0);
+    totalMetrics->Reset();
+    for (auto it = liveMetrics.begin(); it != liveMetrics.end(); it++)
+    {
+        FoldBblSummaries(*it);
+        (*it)->FlushTimedBlock();
+        threadReports.push_back(MakeThreadReport(*it));
+        totalMetrics->Merge(**it);
+        (*it)->Reset();
+    }
+    totalMetrics->Merge(*retiredMetrics);
+    retiredMetrics->Reset();
+
+    if (traceMode)
+        PrintTraceResults();
+    else
+        PrintResults(*out, totalMetrics, MakeReportInfo());
+    if (numThreads > 1 && !traceMode)
+        PrintThreadReports();
+    if (resultWriter)
+        AddResultRows(totalMetrics);
+    threadReports.clear();
+    if (collectBbv)
+        WriteBbv();
+    PIN_ReleaseLock(&metricsLock);
+}
+
+VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    Metrics *m = new Metrics();
+    m->tid = tid;
+    m->InitFootprints((UINT64)KnobFootprintBudget.Value() << 20, KnobFootprintSketchBits.Value());
+    // private hierarchy per thread, L2 and LLC included
+    if (cacheModel)
+        m->caches.Init(cacheConfigs, cachePolicy, KnobMemLatency.Value());
+    if (branchModel)
+        m->branches.Init(branchPredictors, numBranchPredictors, KnobBranchTableBits.Value(), KnobBtbBits.Value(), KnobRasSize.Value());
+    if (timingModel)
+        m->timing.Init(KnobRobSize.Value(), KnobIssueWidth.Value(), cacheModel, cacheModel ? cacheConfigs[CACHE_L1D].latency : 1,
+                       KnobMemLatency.Value());
+    if (tlbModel)
+        m->tlb.Init(tlbConfigs);
+    if (prefetchModel)
+        m->prefetch.Init(cacheConfigs[CACHE_L1D], cachePolicy, KnobPrefetchTableBits.Value(), KnobPrefetchDegree.Value());
+    if (KnobReuse.Value() && (metricMask & METRIC_FOOTPRINT))
+        m->reuse.Init(1.0 / KnobReuseSample.Value(), KnobReuseBudget.Value(), KnobReuseInterval.Value());
+    m->attributeData = hotCode && (metricMask & METRIC_FOOTPRINT);
+    m->metrics = metricMask;
+
+    PIN_GetLock(&metricsLock, tid + 1);
+    liveMetrics.push_back(m);
+    numThreads++;
+    numLiveThreads++;
+    PIN_ReleaseLock(&metricsLock);
+
+    PIN_SetThreadData(metricsKey, m, tid);
+    PIN_SetContextReg(ctxt, metricsReg, (ADDRINT)m);
+    PIN_SetContextReg(ctxt, budgetReg, SetBudget(m));
+}
+
+VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v)
+{
+    Metrics *m = (Metrics *)PIN_GetThreadData(metricsKey, tid);
+    if (m == 0)
+        return;
+    TakeBudget(m, PIN_GetContextReg(ctxt, budgetReg));
+    SyncCount(m);
+
+    PIN_GetLock(&metricsLock, tid + 1);
+    FoldBblSummaries(m);
+    m->FlushTimedBlock();
+    threadReports.push_back(MakeThreadReport(m));
+    retiredMetrics->Merge(*m);
+    liveMetrics.erase(std::find(liveMetrics.begin(), liveMetrics.end(), m));
+    numLiveThreads--;
+    PIN_ReleaseLock(&metricsLock);
+
+    PIN_SetThreadData(metricsKey, 0, tid);
+    delete m;
+}
+
+// Instructions executed so far, up to what the threads counted since their last sync. Called with metricsLock held.
+UINT64 CurrentInsCount(void)
+{
+    UINT64 total = insCount;
+    for (auto it = liveMetrics.begin(); it != liveMetrics.end(); it++)
+        total += (*it)->pending;
+    return total;
+}
+
+// Charge the time and instructions since the last sample to the current phase
+VOID SampleProgress(void)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    PIN_GetLock(&metricsLock, 0);
+    UINT64 ins = CurrentInsCount();
+    PIN_ReleaseLock(&metricsLock);
+    UINT32 phase = detailPhase ? 1 : 0;
+    phaseSeconds[phase] += std::chrono::duration<FLT64>(now - lastSample).count();
+    phaseIns[phase] += ins > lastSampleIns ? ins - lastSampleIns : 0;
+    lastSample = now;
+    lastSampleIns = ins;
+}
+
+VOID WriteProgressHeader(void)
+{
+    *progressOut << "seconds\tinstructions\tphase\twindow\tfast_forward_pct\tmips\tavg_mips\tskip_seconds\tskip_mips"
+                 << "\tdetail_seconds\tdetail_mips\tinstrument_seconds\treport_seconds";
+    for (UINT32 i = 0; i < INST_METRICS_COUNTERS; i++)
+        *progressOut << "\t" << instMetricsNames[i];
+    if (cacheModel)
+        for (UINT32 i = 0; i < CACHE_LEVELS; i++)
+        {
+            string level = cacheLevelNames[i];
+            std::transform(level.begin(), level.end(), level.begin(), ::tolower);
+            *progressOut << "\t" << level << "_accesses\t" << level << "_misses";
+        }
+    if (branchModel)
+        *progressOut << "\tcond_branches\t" << branchPredictorNames[branchPredictors[0]] << "_misses";
+    *progressOut << endl;
+}
+
+// Counter of a running thread's shard. A single 8 byte load, also on ia32,
+// where a plain UINT64 read is two loads that can straddle a carry.
+inline UINT64 LoadCounter(const volatile UINT64 &counter)
+{
+    return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+}
+
+// One line of progress with a snapshot of the current window. The shards are
+// read while their threads keep running: every counter is a value it had, but
+// they are not all taken at the same instruction. Blocks only count once
+// executed, when their records are complete.
+VOID WriteProgress(const char *phase)
+{
+    SampleProgress();
+    FLT64 seconds = std::chrono::duration<FLT64>(lastSample - progressStart).count();
+    UINT64 ins = lastSampleIns;
+
+    InstMetrics snapshot;
+    UINT64 cacheCounts[CACHE_LEVELS][2] = {};
+    UINT64 condBranches = 0, condMisses = 0;
+    vector<const Metrics *> shards;
+    PIN_GetLock(&metricsLock, 0);
+    shards.assign(liveMetrics.begin(), liveMetrics.end());
+    shards.push_back(retiredMetrics);
+    for (auto it = shards.begin(); it != shards.end(); it++)
+    {
+        const Metrics *m = *it;
+        for (UINT32 i = 0; i < INST_METRICS_COUNTERS; i++)
+            ((UINT64 *)&snapshot)[i] += LoadCounter(((const UINT64 *)&m->instMetrics)[i]);
+        for (UINT32 i = 0; i < CACHE_LEVELS; i++)
+        {
+            cacheCounts[i][0] += LoadCounter(m->caches.level[i].accesses);
+            cacheCounts[i][1] += LoadCounter(m->caches.level[i].misses);
         }
-        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)CheckTerminate, IARG_END);
-        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)Terminate, IARG_END);
+        condBranches += LoadCounter(m->branches.condBranches);
+        condMisses += LoadCounter(m->branches.condMisses[0]);
+    }
+    // the unfolded block counts, see FoldBblSummaries()
+    for (auto it = bblSummaries.begin(); it != bblSummaries.end(); it++)
+    {
+        const BblSummary *summary = it->second;
+        UINT64 n = 0;
+        for (auto shard = liveMetrics.begin(); shard != liveMetrics.end(); shard++)
+            if (summary->id < (*shard)->bblExec.size())
+                n += LoadCounter((*shard)->bblExec[summary->id]);
+        if (n == 0)
+            continue;
+        for (auto ins = summary->ins.begin(); ins != summary->ins.end(); ins++)
+        {
+            if (ins->predicated)
+                continue;
+            *(UINT64 *)((UINT8 *)&snapshot + ins->insTypeOffset) += n;
+            snapshot.numLoads += n * ins->numLoads;
+            snapshot.numStores += n * ins->numStores;
+        }
+    }
+    PIN_ReleaseLock(&metricsLock);
+
+    FLT64 rowSeconds = seconds - lastRowSeconds;
+    UINT64 rowIns = ins > lastRowIns ? ins - lastRowIns : 0;
+    *progressOut << std::fixed << std::setprecision(1) << seconds << "\t" << ins << "\t"
+                 << (phase ? phase : (detailPhase ? "detail" : "skip")) << "\t" << windowIndex + 1 << "\t"
+                 << (fastForward && ins < fastForward ? 100.0 * ins / fastForward : 100.0) << "\t"
+                 << std::setprecision(2) << (rowSeconds > 0 ? rowIns / rowSeconds / 1e6 : 0.0) << "\t"
+                 << (seconds > 0 ? ins / seconds / 1e6 : 0.0) << "\t" << std::setprecision(1) << phaseSeconds[0] << "\t"
+                 << std::setprecision(2) << (phaseSeconds[0] > 0 ? phaseIns[0] / phaseSeconds[0] / 1e6 : 0.0) << "\t"
+                 << std::setprecision(1) << phaseSeconds[1] << "\t" << std::setprecision(2)
+                 << (phaseSeconds[1] > 0 ? phaseIns[1] / phaseSeconds[1] / 1e6 : 0.0) << "\t" << std::setprecision(3)
+                 << LoadCounter(instrumentNanos) / 1e9 << "\t" << LoadCounter(reportNanos) / 1e9;
+    for (UINT32 i = 0; i < INST_METRICS_COUNTERS; i++)
+        *progressOut << "\t" << ((const UINT64 *)&snapshot)[i];
+    if (cacheModel)
+        for (UINT32 i = 0; i < CACHE_LEVELS; i++)
+            *progressOut << "\t" << cacheCounts[i][0] << "\t" << cacheCounts[i][1];
+    if (branchModel)
+        *progressOut << "\t" << condBranches << "\t" << condMisses;
+    // flushed every line, the file is all that is left of a killed run
+    *progressOut << endl;
+    lastRowSeconds = seconds;
+    lastRowIns = ins;
+}
+
+// Internal thread sampling the phases every PROGRESS_TICK_MS and writing a line every -progress_interval
+#define PROGRESS_TICK_MS 100
+VOID ProgressWriter(VOID *arg)
+{
+    UINT64 ticksPerLine = KnobProgressInterval.Value() * 1000ULL / PROGRESS_TICK_MS;
+    for (UINT64 tick = 1; !progressExit; tick++)
+    {
+        PIN_Sleep(PROGRESS_TICK_MS);
+        if (tick % ticksPerLine == 0)
+            WriteProgress(0);
+        else
+            SampleProgress();
+    }
+}
+
+VOID StopProgressWriter(VOID *v)
+{
+    progressExit = TRUE;
+    INT32 exitCode;
+    PIN_WaitForThreadTermination(progressUid, PIN_INFINITE_TIMEOUT, &exitCode);
+}
+
+VOID PrintCallCounts(void)
+{
+    *out << "\n=================ANALYSIS CALLS================" << endl;
+    for (UINT32 i = 0; i < CALL_KINDS; i++)
+        *out << std::setw(35) << std::left << callNames[i] << callCounts[i] << endl;
+}
+
+// Counts of one routine, image or instruction of the hot code report
+typedef struct _HotCount
+{
+    UINT64 ins;
+    UINT64 loads;
+    UINT64 stores;
+    UINT64 touches;
+} HotCount;
+
+// Sort key of the hot code tables, most instructions first
+template <class KEY>
+static BOOL HotterThan(const pair<KEY, HotCount> &a, const pair<KEY, HotCount> &b)
+{
+    return a.second.ins > b.second.ins || (a.second.ins == b.second.ins && a.first < b.first);
+}
+
+// Executions of every block times its instruction records give the counts per
+// instruction, which add up to routines, images and the loop bodies around them.
+VOID PrintHotCode(void)
+{
+    PIN_GetLock(&metricsLock, 0);
+    map<ADDRINT, HotCount> ips;
+    vector<HotCount> routineCounts(routines.size(), HotCount());
+    UINT64 total = 0;
+    for (auto it = bblSummaries.begin(); it != bblSummaries.end(); it++)
+    {
+        BblSummary *summary = it->second;
+        UINT64 n = summary->id < blockTotals.size() ? blockTotals[summary->id] : 0;
+        UINT64 touches = summary->id < blockTouches.size() ? blockTouches[summary->id] : 0;
+        if (n == 0 && touches == 0)
+            continue;
+        HotCount &routine = routineCounts[summary->id < blockRoutines.size() ? blockRoutines[summary->id] : 0];
+        routine.touches += touches;
+        for (auto ins = summary->ins.begin(); ins != summary->ins.end(); ins++)
+        {
+            HotCount &ip = ips[ins->insAddr];
+            ip.ins += n;
+            ip.loads += n * ins->numLoads;
+            ip.stores += n * ins->numStores;
+            routine.ins += n;
+            routine.loads += n * ins->numLoads;
+            routine.stores += n * ins->numStores;
+        }
+        total += n * summary->ins.size();
+    }
 
-        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)DoInsCount, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+    vector<pair<UINT32, HotCount> > hotRoutines;
+    map<string, HotCount> images;
+    for (UINT32 i = 0; i < routineCounts.size(); i++)
+    {
+        if (routineCounts[i].ins == 0 && routineCounts[i].touches == 0)
+            continue;
+        hotRoutines.push_back(std::make_pair(i, routineCounts[i]));
+        HotCount &image = images[i ? routines[i].image : "?"];
+        image.ins += routineCounts[i].ins;
+        image.loads += routineCounts[i].loads;
+        image.stores += routineCounts[i].stores;
+        image.touches += routineCounts[i].touches;
+    }
+    std::sort(hotRoutines.begin(), hotRoutines.end(), HotterThan<UINT32>);
+    vector<pair<string, HotCount> > hotImages(images.begin(), images.end());
+    std::sort(hotImages.begin(), hotImages.end(), HotterThan<string>);
+
+    // a loop runs its body once per execution of the back edge at its tail
+    vector<pair<pair<ADDRINT, ADDRINT>, HotCount> > hotLoops;
+    for (auto it = loops.begin(); it != loops.end(); it++)
+    {
+        auto tail = ips.find(it->second.tail);
+        if (tail == ips.end() || tail->second.ins == 0)
+            continue;
+        HotCount loop = HotCount();
+        loop.touches = tail->second.ins;
+        for (auto ip = ips.lower_bound(it->second.head); ip != ips.end() && ip->first <= it->second.tail; ip++)
+        {
+            loop.ins += ip->second.ins;
+            loop.loads += ip->second.loads;
+            loop.stores += ip->second.stores;
+        }
+        hotLoops.push_back(std::make_pair(it->first, loop));
+    }
+    std::sort(hotLoops.begin(), hotLoops.end(), HotterThan<pair<ADDRINT, ADDRINT> >);
+    vector<pair<ADDRINT, HotCount> > hotIps(ips.begin(), ips.end());
+    std::sort(hotIps.begin(), hotIps.end(), HotterThan<ADDRINT>);
+
+    size_t top = KnobHotTop.Value();
+    *out << "\n===================HOT CODE====================" << endl;
+    *out << "Instructions of all windows: " << total << endl;
+    *out << "\nHottest routines" << endl;
+    *out << std::setw(16) << std::left << "Instructions" << std::setw(10) << "%" << std::setw(14) << "Loads" << std::setw(14)
+         << "Stores" << std::setw(14) << "Data blocks" << "Routine (image)" << endl;
+    for (size_t i = 0; i < hotRoutines.size() && i < top; i++)
+    {
+        const HotCount &c = hotRoutines[i].second;
+        UINT32 id = hotRoutines[i].first;
+        *out << std::setw(16) << c.ins << std::setw(10) << std::fixed << std::setprecision(2) << (total ? 100.0 * c.ins / total : 0.0)
+             << std::setw(14) << c.loads << std::setw(14) << c.stores << std::setw(14) << c.touches
+             << (id ? routines[id].name + " (" + routines[id].image + ")" : string("?")) << endl;
+    }
+    *out << "\nImages" << endl;
+    for (size_t i = 0; i < hotImages.size(); i++)
+    {
+        const HotCount &c = hotImages[i].second;
+        *out << std::setw(16) << c.ins << std::setw(10) << (total ? 100.0 * c.ins / total : 0.0) << std::setw(14) << c.loads
+             << std::setw(14) << c.stores << std::setw(14) << c.touches << hotImages[i].first << endl;
+    }
+    *out << "\nHottest loops" << endl;
+    *out << std::setw(16) << "Instructions" << std::setw(10) << "%" << std::setw(14) << "Iterations" << std::setw(14)
+         << "Ins/iteration" << std::setw(40) << "Head-tail" << "Routine" << endl;
+    for (size_t i = 0; i < hotLoops.size() && i < top; i++)
+    {
+        const HotCount &c = hotLoops[i].second;
+        const LoopInfo &loop = loops[hotLoops[i].first];
+        *out << std::setw(16) << c.ins << std::setw(10) << (total ? 100.0 * c.ins / total : 0.0) << std::setw(14) << c.touches
+             << std::setw(14) << (c.touches ? 1.0 * c.ins / c.touches : 0.0) << std::setw(40)
+             << hexstr(loop.head) + "-" + hexstr(loop.tail) << (loop.routine ? routines[loop.routine].name : string("?")) << endl;
     }
+    *out << "\nHottest instructions" << endl;
+    *out << std::setw(20) << "Address" << std::setw(16) << "Executions" << std::setw(14) << "Loads" << "Stores" << endl;
+    for (size_t i = 0; i < hotIps.size() && i < top; i++)
+        *out << std::setw(20) << hexstr(hotIps[i].first) << std::setw(16) << hotIps[i].second.ins << std::setw(14)
+             << hotIps[i].second.loads << hotIps[i].second.stores << endl;
+    PIN_ReleaseLock(&metricsLock);
 }
 
-#define PRINT_METRICS(name, total)                                                    \
-    std::setw(10) << std::right << name << " (" << std::fixed << std::setprecision(2) \
-                  << std::setw(5) << std::right << (100.0 * name / total) << "%"      \
-                  << ")" << std::endl
+// Layout advice of HW1Layout.h on the blocks executed in all windows. The main
+// image's routines go to the ordering file in their new order, one symbol per
+// line as lld --symbol-ordering-file and gold --section-ordering-file (with
+// -ffunction-sections) take them.
+VOID PrintCodeLayout(void)
+{
+    PIN_GetLock(&metricsLock, 0);
+    vector<LayoutBlock> blocks;
+    for (UINT32 id = 0; id < layoutBlocks.size(); id++)
+    {
+        if (layoutBlocks[id].size == 0)
+            continue;
+        LayoutBlock block = layoutBlocks[id];
+        block.executions = id < blockTotals.size() ? blockTotals[id] : 0;
+        block.taken = id < blockTaken.size() ? blockTaken[id] : 0;
+        blocks.push_back(block);
+    }
+    vector<LayoutRoutine> ranges(routines.size(), LayoutRoutine());
+    for (UINT32 r = 1; r < routines.size(); r++)
+    {
+        ranges[r].address = routines[r].address;
+        ranges[r].size = routines[r].size;
+    }
+    UINT32 lineSize = cacheModel ? cacheConfigs[CACHE_L1I].lineSize : 64;
+    CodeLayout layout;
+    layout.Build(blocks, ranges, Log2(lineSize));
+
+    std::ofstream orderFile(KnobLayoutFile.Value().c_str());
+    UINT32 written = 0;
+    for (auto r = layout.order.begin(); r != layout.order.end(); r++)
+        if (routines[*r].mainImage)
+        {
+            orderFile << routines[*r].symbol << endl;
+            written++;
+        }
+
+    *out << "\n==================CODE LAYOUT==================" << endl;
+    *out << "Executed routines: " << layout.order.size() << ", " << written << " of the main image written to "
+         << KnobLayoutFile.Value() << endl;
+    *out << "Call edges: " << layout.callEdges << ", block edges: " << layout.blockEdges << endl;
+    *out << std::setw(24) << std::left << "Instruction footprint" << std::setw(16) << "Now" << std::setw(16) << "Ordered"
+         << "Ordered and split" << endl;
+    *out << std::setw(24) << "32 byte regions" << std::setw(16) << layout.before.regions << std::setw(16) << layout.ordered.regions
+         << layout.split.regions << endl;
+    *out << std::setw(24) << (decstr(lineSize) + " byte lines") << std::setw(16) << layout.before.lines << std::setw(16)
+         << layout.ordered.lines << layout.split.lines << endl;
+    *out << std::setw(24) << "4KB pages" << std::setw(16) << layout.before.pages << std::setw(16) << layout.ordered.pages
+         << layout.split.pages << endl;
+    FLT64 kilo = std::max(layout.instructions, (UINT64)1) / 1000.0;
+    *out << "Taken branches per kilo instruction inside routines: " << std::fixed << std::setprecision(3)
+         << layout.takenBefore / kilo << " now, " << layout.takenAfter / kilo << " with the blocks chained" << endl;
+
+    // hot routines with the most bytes that never executed
+    vector<pair<UINT64, UINT32> > candidates;
+    for (auto r = layout.order.begin(); r != layout.order.end(); r++)
+        if (layout.routines[*r].coldBytes > layout.routines[*r].hotBytes)
+            candidates.push_back(std::make_pair(layout.routines[*r].instructions, *r));
+    std::sort(candidates.rbegin(), candidates.rend());
+    *out << "\nHot/cold split candidates, hottest routines with more cold than hot bytes" << endl;
+    *out << std::setw(16) << "Instructions" << std::setw(12) << "Hot bytes" << std::setw(12) << "Cold bytes" << std::setw(10)
+         << "Cold %" << "Routine (image)" << endl;
+    for (size_t i = 0; i < candidates.size() && i < KnobHotTop.Value(); i++)
+    {
+        const LayoutRoutine &routine = layout.routines[candidates[i].second];
+        const RoutineInfo &info = routines[candidates[i].second];
+        *out << std::setw(16) << routine.instructions << std::setw(12) << routine.hotBytes << std::setw(12) << routine.coldBytes
+             << std::setw(10) << std::setprecision(2) << 100.0 * routine.coldBytes / std::max(routine.size, (UINT64)1)
+             << info.name + " (" + info.image + ")" << endl;
+    }
+    PIN_ReleaseLock(&metricsLock);
+}
 
 VOID Fini(INT32 code, VOID *v)
 {
+    // keep the trace of killed runs too
+    if (traceMode)
+    {
+        // the writer thread is gone, write what the exiting threads flushed last
+        while (WriteTraceChunk())
+            ;
+        for (auto it = traceFiles.begin(); it != traceFiles.end(); it++)
+            it->second->close();
+        WriteTraceStatic();
+    }
+
     if (code != 0)
     {
+        if (progressOut)
+            WriteProgress("killed");
         *out << "===============================================" << endl;
         *out << "This application is terminated by PIN." << endl;
         *out << "===============================================" << endl;
         return;
     }
-    UINT64 total = 0;
-    total += instMetrics->numLoads;
-    total += instMetrics->numStores;
-    total += instMetrics->numNops;
-    total += instMetrics->numDirectCalls;
-    total += instMetrics->numIndirectCalls;
-    total += instMetrics->numReturns;
-    total += instMetrics->numUncondBranches;
-    total += instMetrics->numCondBranches;
-    total += instMetrics->numLogicalOps;
-    total += instMetrics->numRotateShift;
-    total += instMetrics->numFlagOps;
-    total += instMetrics->numVector;
-    total += instMetrics->numCondMoves;
-    total += instMetrics->numMMXSSE;
-    total += instMetrics->numSysCalls;
-    total += instMetrics->numFP;
-    total += instMetrics->numRest;
+    // threads still running here keep what their budget register counted since
+    // their last sync, at most MAX_BUDGET instructions each
+    PIN_GetLock(&metricsLock, 0);
+    for (auto it = liveMetrics.begin(); it != liveMetrics.end(); it++)
+        SyncCount(*it);
+    PIN_ReleaseLock(&metricsLock);
 
-    *out << "===============================================" << endl;
-    *out << "HW1 analysis results from " << KnobOutputFile.Value() << endl;
-    *out << "Number of instructions: " << insCount << endl;
-    *out << "Fast forward at:        " << fastForward << endl;
-    *out << "Number of instructions after fast forward: " << insCount - fastForward << endl;
-    *out << "\n=====================PARTA=====================" << endl;
-    *out << std::setw(35) << std::left << "Number of loads:" << PRINT_METRICS(instMetrics->numLoads, total);
-    *out << std::setw(35) << std::left << "Number of stores:" << PRINT_METRICS(instMetrics->numStores, total);
-    *out << std::setw(35) << std::left << "Number of nops:" << PRINT_METRICS(instMetrics->numNops, total);
-    *out << std::setw(35) << std::left << "Number of direct calls:" << PRINT_METRICS(instMetrics->numDirectCalls, total);
-    *out << std::setw(35) << std::left << "Number of indirect calls:" << PRINT_METRICS(instMetrics->numIndirectCalls, total);
-    *out << std::setw(35) << std::left << "Number of returns:" << PRINT_METRICS(instMetrics->numReturns, total);
-    *out << std::setw(35) << std::left << "Number of unconditional branches:" << PRINT_METRICS(instMetrics->numUncondBranches, total);
-    *out << std::setw(35) << std::left << "Number of conditional branches:" << PRINT_METRICS(instMetrics->numCondBranches, total);
-    *out << std::setw(35) << std::left << "Number of logical operations:" << PRINT_METRICS(instMetrics->numLogicalOps, total);
-    *out << std::setw(35) << std::left << "Number of rotate/shift operations:" << PRINT_METRICS(instMetrics->numRotateShift, total);
-    *out << std::setw(35) << std::left << "Number of flag operations:" << PRINT_METRICS(instMetrics->numFlagOps, total);
-    *out << std::setw(35) << std::left << "Number of vector operations:" << PRINT_METRICS(instMetrics->numVector, total);
-    *out << std::setw(35) << std::left << "Number of conditional moves:" << PRINT_METRICS(instMetrics->numCondMoves, total);
-    *out << std::setw(35) << std::left << "Number of MMX/SSE operations:" << PRINT_METRICS(instMetrics->numMMXSSE, total);
-    *out << std::setw(35) << std::left << "Number of system calls:" << PRINT_METRICS(instMetrics->numSysCalls, total);
-    *out << std::setw(35) << std::left << "Number of FP operations:" << PRINT_METRICS(instMetrics->numFP, total);
-    *out << std::setw(35) << std::left << "Number of other instructions:" << PRINT_METRICS(instMetrics->numRest, total);
-    *out << "\n=====================PARTB=====================" << endl;
-    // CPI numloads You should charge each load and store operation a fixed latency of
-    // seventy cycles and every other instruction a latency of one cycle.
-    FLT64 cpi = (instMetrics->numLoads + instMetrics->numStores) * 70.0 / total + (total - instMetrics->numLoads - instMetrics->numStores) * 1.0 / total;
-    *out << "CPI: " << cpi << endl;
-    *out << "\n=====================PARTC=====================" << endl;
-    // Instruction footprint
-    *out << "Number of 32 bytes region for data " << dataFootprint.size() << endl;
-    *out << "Size of region is " << dataFootprint.size() * 32 << " bytes" << endl;
-    *out << "Number of 32 bytes region for instructions " << insFootprint.size() << endl;
-    *out << "Size of region is " << insFootprint.size() * 32 << " bytes " << endl;
-    *out << "\n=====================PARTD=====================" << endl;
-
-    // Instruction length and frequency
-    *out << "\nD1 Distribution of instruction length (All Ins)" << endl;
-    for (auto it = insLengthMap.begin(); it != insLengthMap.end(); it++)
-        *out << "Number of Instruction of " << it->first << " bytes: " << it->second << endl;
-
-    // operands count and frequency
-    *out << "\nD2 Distribution of the number of operands in an instruction (All Ins)" << endl;
-    for (auto it = insOperandsMap.begin(); it != insOperandsMap.end(); it++)
-        *out << "Number of Instruction of " << it->first << " operands: " << it->second << endl;
-
-    // register read operands
-    *out << "\nD3 Distribution of the number of register read operands in an instruction (All Ins)" << endl;
-    for (auto it = insRegReadMap.begin(); it != insRegReadMap.end(); it++)
-        *out << "Number of Instruction of " << it->first << " register read operands: " << it->second << endl;
-
-    // register write operands
-    *out << "\nD4 Distribution of the number of register write operands in an instruction (All Ins)" << endl;
-    for (auto it = insRegWriteMap.begin(); it != insRegWriteMap.end(); it++)
-        *out << "Number of Instruction of " << it->first << " register write operands: " << it->second << endl;
-
-    // memory operands
-    UINT64 memins = 0;
-    *out << "\nD5 Distribution of the number of memory operands in an instruction (Predicated Ins)" << endl;
-    for (auto it = insMemOperandsMap.begin(); it != insMemOperandsMap.end(); it++)
-    {
-        *out << "Number of Instruction of " << it->first << " memory operands: " << it->second << endl;
-        if (it->first > 0)
-            memins += it->second;
-    }
-
-    // memory read operands
-    *out << "\nD6 Distribution of the number of memory read operands in an instruction (Predicated Ins)" << endl;
-    for (auto it = insMemReadMap.begin(); it != insMemReadMap.end(); it++)
-        *out << "Number of Instruction of " << it->first << " memory read operands: " << it->second << endl;
-
-    // memory write operands
-    *out << "\nD7 Distribution of the number of memory write operands in an instruction (Predicated Ins)" << endl;
-    for (auto it = insMemWriteMap.begin(); it != insMemWriteMap.end(); it++)
-        *out << "Number of Instruction of " << it->first << " memory write operands: " << it->second << endl;
-
-    // memory touched
-    *out << "\nD8 Maximum and average number of memory bytes touched by any memory instruction (Predicated Ins)" << endl;
-    *out << "Maximum number of memory bytes touched: " << insMemTouchedMax << endl;
-    *out << "Average number of memory bytes touched: " << insMemTouched * 1.0 / memins << endl;
-
-    *out << "\nD9 Maximum and minimum values of the immediate field in an instruction." << endl;
-    *out << "Maximum value of the immediate field: " << immediateMax << endl;
-    *out << "Minimum value of the immediate field: " << immediateMin << endl;
-
-    *out << "\nD10 Maximum and minimum values of the displacement field in a memory instruction(Predicated Ins)" << endl;
-    *out << "Maximum value of the displacement field: " << displacementMax << endl;
-    *out << "Minimum value of the displacement field: " << displacementMin << endl;
-
-    *out << "===============================================" << endl;
-
-    *out << "\nFor General max-min:" << endl;
-    *out << "INT32_MAX = " << INT32_MAX << endl;
-    *out << "INT32_MIN = " << INT32_MIN << endl;
-
-    std::chrono::time_point<std::chrono::system_clock> endTime = std::chrono::system_clock::now();
-    std::chrono::duration<double> elapsed_seconds = endTime - startTime;
-    *out << "\nTime elapsed: " << elapsed_seconds.count() / 60 << " minutes" << endl;
+    // before ReportWindow() starts the shards over
+    if (progressOut)
+        WriteProgress("end");
+    // an application that exits while skipping has no window to report
+    if (detailPhase)
+        ReportWindow();
+    else
+    {
+        *out << "===============================================" << endl;
+        *out << "Window " << windowIndex + 1 << " not reached: the application exited after " << insCount
+             << " instructions, the window starts at " << windowStart << "." << endl;
+        *out << "===============================================" << endl;
+    }
+    if (countCalls)
+        PrintCallCounts();
+    if (hotCode)
+        PrintHotCode();
+    if (layoutProfile)
+        PrintCodeLayout();
+    if (bbvOut)
+        bbvOut->flush();
+    if (resultWriter)
+        WriteResultFile();
 }
 
 /*!
@@ -573,12 +2045,187 @@ int main(int argc, char *argv[])
         out = new std::ofstream(fileName.c_str());
     }
 
-    instMetrics = new InstMetrics();
+    PIN_InitLock(&metricsLock);
+    metricsKey = PIN_CreateThreadDataKey(0);
+    metricsReg = PIN_ClaimToolRegister();
+    budgetReg = PIN_ClaimToolRegister();
+    if (!REG_valid(metricsReg) || !REG_valid(budgetReg))
+    {
+        cerr << "ERROR: no tool register left for the per thread metrics and budget" << endl;
+        return 1;
+    }
+    if (KnobFootprintSketchBits.Value() < FOOTPRINT_MIN_SKETCH_BITS || KnobFootprintSketchBits.Value() > FOOTPRINT_MAX_SKETCH_BITS)
+    {
+        cerr << "ERROR: -footprint_sketch_bits must be between " << FOOTPRINT_MIN_SKETCH_BITS << " and " << FOOTPRINT_MAX_SKETCH_BITS << endl;
+        return Usage();
+    }
+    retiredMetrics = new Metrics();
+    totalMetrics = new Metrics();
+    retiredMetrics->InitFootprints((UINT64)KnobFootprintBudget.Value() << 20, KnobFootprintSketchBits.Value());
+    totalMetrics->InitFootprints((UINT64)KnobFootprintBudget.Value() << 20, KnobFootprintSketchBits.Value());
     fastForward = KnobFastForward.Value() * 1e9;
+    windowLength = KnobWindowLength.Value() * 1000000;
+    windowPeriod = KnobWindowPeriod.Value() * 1000000;
+    if (windowPeriod < windowLength)
+        windowPeriod = windowLength;
+    numWindows = KnobWindowCount.Value() > 0 ? KnobWindowCount.Value() : 1;
+    windowStart = fastForward;
+    windowEnd = windowStart + windowLength;
+    detailPhase = (fastForward == 0);
+
+    if (!KnobBbvFile.Value().empty())
+    {
+        // the vectors are built from the basic block records
+        if (KnobBblSummary.Value())
+            bbvOut = new std::ofstream(KnobBbvFile.Value().c_str());
+        else
+            cerr << "WARNING: -bbv needs -bbl_summary 1, no basic block vectors written" << endl;
+    }
+    cacheModel = KnobCacheModel.Value();
+    // the prefetch model has its own L1D of the -l1d geometry
+    if (cacheModel || KnobPrefetch.Value())
+    {
+        const string specs[CACHE_LEVELS] = {KnobL1D.Value(), KnobL1I.Value(), KnobL2.Value(), KnobLLC.Value()};
+        for (UINT32 i = 0; i < CACHE_LEVELS; i++)
+            if (!ParseCacheConfig(specs[i], cacheConfigs[i], i >= CACHE_L2))
+            {
+                cerr << "ERROR: bad " << cacheLevelNames[i] << " cache " << specs[i]
+                     << ", expected size in KB:ways:line bytes:latency with power of two sets and lines, size 0 only for L2 and LLC" << endl;
+                return Usage();
+            }
+        if (!ParseCachePolicy(KnobCachePolicy.Value(), cachePolicy))
+        {
+            cerr << "ERROR: unknown cache policy " << KnobCachePolicy.Value() << endl;
+            return Usage();
+        }
+    }
+    UINT32 groups;
+    if (!ParseMetricGroups(KnobMetrics.Value(), groups))
+    {
+        cerr << "ERROR: bad metric groups " << KnobMetrics.Value() << ", expected mix, footprint, partd or all" << endl;
+        return Usage();
+    }
+    traceMode = !KnobTraceFile.Value().empty();
+    // the trace files have no window boundaries, and a thread's buffer is only written once full
+    if (traceMode && numWindows > 1)
+    {
+        cerr << "ERROR: -trace captures a single window, run it once per window with -f and -w instead of -n" << endl;
+        return Usage();
+    }
+    // the model walks the instructions of the basic block records
+    timingModel = KnobTiming.Value() && KnobBblSummary.Value() && !traceMode;
+    if (KnobTiming.Value() && !timingModel)
+        cerr << "WARNING: -timing needs -bbl_summary 1 and no -trace, no timing model" << endl;
+    if (timingModel && (KnobRobSize.Value() == 0 || KnobRobSize.Value() > MAX_ROB_SIZE || KnobIssueWidth.Value() == 0))
+    {
+        cerr << "ERROR: -rob must be between 1 and " << MAX_ROB_SIZE << " and -issue_width at least 1" << endl;
+        return Usage();
+    }
+    tlbModel = KnobTlb.Value() && !traceMode;
+    if (KnobTlb.Value() && !tlbModel)
+        cerr << "WARNING: -tlb is not available with -trace, no TLB model" << endl;
+    if (tlbModel)
+    {
+        const string specs[TLB_LEVELS] = {KnobDtlb.Value(), KnobItlb.Value(), KnobStlb.Value()};
+        for (UINT32 i = 0; i < TLB_LEVELS; i++)
+            if (!ParseTlbConfig(specs[i], tlbConfigs[i]) || (i != TLB_STLB && tlbConfigs[i].entries == 0))
+            {
+                cerr << "ERROR: bad " << tlbLevelNames[i] << " " << specs[i] << ", expected entries:ways with power of two sets" << endl;
+                return Usage();
+            }
+    }
+    metricMask = groups | (cacheModel ? METRIC_CACHE : 0) | (timingModel ? METRIC_TIMING : 0) | (tlbModel ? METRIC_TLB : 0);
+    if (!(metricMask & METRIC_FOOTPRINT) && (KnobReuse.Value() || KnobHotCode.Value()))
+        cerr << "WARNING: -reuse and the data columns of -hot need the footprint metrics, not measured" << endl;
+    // one specialization of the analysis routines for the whole run
+    SelectAnalysisRoutines select = {&analysisRoutines};
+    MetricDispatch<SelectAnalysisRoutines>::Run(metricMask, select);
+    if (KnobReuse.Value() && (KnobReuseSample.Value() == 0 || KnobReuseInterval.Value() == 0))
+    {
+        cerr << "ERROR: -reuse_sample and -reuse_interval must be at least 1" << endl;
+        return Usage();
+    }
+    // the trace holds no pcs of the memory operands
+    prefetchModel = KnobPrefetch.Value() && !traceMode;
+    if (prefetchModel && (KnobPrefetchTableBits.Value() > 20 || KnobPrefetchDegree.Value() == 0 ||
+                          KnobPrefetchDegree.Value() > MAX_PREFETCH_DEGREE))
+    {
+        cerr << "ERROR: -prefetch needs -prefetch_table_bits at most 20 and -prefetch_degree between 1 and "
+             << MAX_PREFETCH_DEGREE << endl;
+        return Usage();
+    }
+    // the trace holds no branch outcomes
+    branchModel = KnobBranchModel.Value() && !traceMode;
+    if (branchModel)
+    {
+        if (!ParseBranchPredictors(KnobBranchPredictors.Value(), branchPredictors, numBranchPredictors))
+        {
+            cerr << "ERROR: bad branch predictor list " << KnobBranchPredictors.Value() << ", expected up to "
+                 << MAX_BRANCH_PREDICTORS << " of bimodal, gshare and tage" << endl;
+            return Usage();
+        }
+        if (KnobBranchTableBits.Value() < 4 || KnobBranchTableBits.Value() > 24 || KnobBtbBits.Value() > 24)
+        {
+            cerr << "ERROR: -branch_table_bits must be between 4 and 24 and -btb_bits at most 24" << endl;
+            return Usage();
+        }
+    }
+    if (traceMode)
+    {
+        PIN_InitLock(&traceLock);
+        traceFormat = KnobTraceRaw.Value() ? TRACE_FORMAT_RAW : TRACE_FORMAT_VARINT;
+        traceBuffer = PIN_DefineTraceBuffer(sizeof(TraceRecord), KnobTracePages.Value(), TraceBufferFull, 0);
+        if (traceBuffer == BUFFER_ID_INVALID)
+        {
+            cerr << "ERROR: could not define the trace buffer" << endl;
+            return 1;
+        }
+        if (PIN_SpawnInternalThread(TraceWriter, 0, 0, &traceWriterUid) == INVALID_THREADID)
+        {
+            cerr << "ERROR: could not start the trace writer thread" << endl;
+            return 1;
+        }
+        PIN_AddPrepareForFiniFunction(StopTraceWriter, 0);
+    }
+    // not in -trace mode, where the analysis routines are replaced by buffer writes
+    countCalls = KnobCallCounts.Value() && !traceMode;
+    if (!KnobProgressFile.Value().empty())
+    {
+        if (KnobProgressInterval.Value() == 0)
+        {
+            cerr << "ERROR: -progress_interval must be at least 1" << endl;
+            return Usage();
+        }
+        progressOut = new std::ofstream(KnobProgressFile.Value().c_str());
+        progressStart = lastSample = std::chrono::steady_clock::now();
+        WriteProgressHeader();
+        if (PIN_SpawnInternalThread(ProgressWriter, 0, 0, &progressUid) == INVALID_THREADID)
+        {
+            cerr << "ERROR: could not start the progress thread" << endl;
+            return 1;
+        }
+        PIN_AddPrepareForFiniFunction(StopProgressWriter, 0);
+    }
+    // the profile hangs off the basic block records, the trace holds no routines
+    hotCode = KnobHotCode.Value() && KnobBblSummary.Value() && !traceMode;
+    if (KnobHotCode.Value() && !hotCode)
+        cerr << "WARNING: -hot needs -bbl_summary 1 and no -trace, no hot code profile" << endl;
+    layoutProfile = !KnobLayoutFile.Value().empty() && KnobBblSummary.Value() && !traceMode;
+    if (!KnobLayoutFile.Value().empty() && !layoutProfile)
+        cerr << "WARNING: -layout needs -bbl_summary 1 and no -trace, no layout written" << endl;
+    if (hotCode || layoutProfile)
+        PIN_InitSymbols();
+    if (!KnobResultFile.Value().empty())
+        SetupResultTables();
+    collectBbv = (bbvOut != 0) || (bbvTable != 0);
 
     // Register function to be called to instrument traces
     TRACE_AddInstrumentFunction(Trace, 0);
 
+    // Register functions to allocate and merge the per thread metrics
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+    PIN_AddThreadFiniFunction(ThreadFini, 0);
+
     // Register function to be called when the application exits
     PIN_AddFiniFunction(Fini, 0);
 
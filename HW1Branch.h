@@ -0,0 +1,414 @@
+/*
+ * Branch prediction model behind the PART B branch CPI.
+ *
+ * Conditional branches go through every configured direction predictor at
+ * once (bimodal, gshare, a small TAGE), so one run compares them on the same
+ * branches. Indirect jumps and calls are predicted by a direct mapped BTB and
+ * returns by a return address stack; direct jumps and calls always hit.
+ * Counters are bit packed: 2 bit counters 32 to a word, TAGE entries 16 bits.
+ */
+
+#ifndef HW1_BRANCH_H
+#define HW1_BRANCH_H
+
+#include "HW1Types.h"
+#include <string>
+#include <cstdlib>
+#include <cstring>
+
+enum
+{
+    BRANCH_PREDICTOR_BIMODAL = 0,
+    BRANCH_PREDICTOR_GSHARE = 1,
+    BRANCH_PREDICTOR_TAGE = 2,
+    BRANCH_PREDICTOR_KINDS = 3
+};
+const char *const branchPredictorNames[BRANCH_PREDICTOR_KINDS] = {"bimodal", "gshare", "tage"};
+
+#define MAX_BRANCH_PREDICTORS 4
+#define MAX_RAS_SIZE 64
+
+// Parse a comma separated predictor list, e.g. gshare,bimodal,tage. The first one drives the CPI.
+inline BOOL ParseBranchPredictors(const std::string &spec, UINT32 *kinds, UINT32 &count)
+{
+    count = 0;
+    size_t start = 0;
+    while (start <= spec.size())
+    {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos)
+            end = spec.size();
+        std::string name = spec.substr(start, end - start);
+        UINT32 kind = 0;
+        while (kind < BRANCH_PREDICTOR_KINDS && name != branchPredictorNames[kind])
+            kind++;
+        if (kind == BRANCH_PREDICTOR_KINDS || count == MAX_BRANCH_PREDICTORS)
+            return FALSE;
+        kinds[count++] = kind;
+        start = end + 1;
+    }
+    return count > 0;
+}
+
+// 2 bit saturating counters, 32 to a UINT64, taken when >= 2
+class CounterTable
+{
+  public:
+    CounterTable() : words(0), mask(0) {}
+    CounterTable(const CounterTable &) = delete;
+    CounterTable &operator=(const CounterTable &) = delete;
+
+    ~CounterTable()
+    {
+        free(words);
+    }
+
+    VOID Init(UINT32 bits)
+    {
+        UINT64 entries = (UINT64)1 << bits;
+        UINT64 numWords = entries < 32 ? 1 : entries / 32;
+        words = (UINT64 *)malloc(numWords * sizeof(UINT64));
+        // every counter weakly taken
+        memset(words, 0xaa, numWords * sizeof(UINT64));
+        mask = entries - 1;
+    }
+
+    inline UINT64 Mask() const
+    {
+        return mask;
+    }
+
+    inline BOOL Taken(UINT64 index) const
+    {
+        index &= mask;
+        return (words[index >> 5] >> ((index & 31) * 2)) & 2;
+    }
+
+    inline VOID Update(UINT64 index, BOOL taken)
+    {
+        index &= mask;
+        UINT64 &word = words[index >> 5];
+        UINT32 shift = (index & 31) * 2;
+        UINT64 counter = (word >> shift) & 3;
+        if (taken && counter < 3)
+            word += (UINT64)1 << shift;
+        else if (!taken && counter > 0)
+            word -= (UINT64)1 << shift;
+    }
+
+  private:
+    UINT64 *words;
+    UINT64 mask;
+};
+
+// Direction predictor. Access predicts the branch at pc, trains on the real
+// outcome and returns TRUE if the prediction was right, like Cache::Access.
+class DirectionPredictor
+{
+  public:
+    virtual ~DirectionPredictor() {}
+    virtual BOOL Access(UINT64 pc, BOOL taken) = 0;
+};
+
+class BimodalPredictor : public DirectionPredictor
+{
+  public:
+    BimodalPredictor(UINT32 bits)
+    {
+        counters.Init(bits);
+    }
+
+    BOOL Access(UINT64 pc, BOOL taken)
+    {
+        BOOL predicted = counters.Taken(pc);
+        counters.Update(pc, taken);
+        return predicted == taken;
+    }
+
+  private:
+    CounterTable counters;
+};
+
+// Counters indexed by pc xor as many bits of global history as the table has index bits
+class GsharePredictor : public DirectionPredictor
+{
+  public:
+    GsharePredictor(UINT32 bits) : history(0)
+    {
+        counters.Init(bits);
+    }
+
+    BOOL Access(UINT64 pc, BOOL taken)
+    {
+        UINT64 index = pc ^ history;
+        BOOL predicted = counters.Taken(index);
+        counters.Update(index, taken);
+        history = ((history << 1) | taken) & counters.Mask();
+        return predicted == taken;
+    }
+
+  private:
+    CounterTable counters;
+    UINT64 history;
+};
+
+// TAGE with a bimodal base and TAGE_TABLES tagged tables on geometric history
+// lengths up to 64 branches. A tagged entry is one UINT16: 3 bit counter in
+// bits 0-2, 2 bit useful counter in bits 3-4 and an 11 bit tag above.
+#define TAGE_TABLES 4
+#define TAGE_TAG_BITS 11
+#define TAGE_RESET_PERIOD (1 << 18)
+
+class TagePredictor : public DirectionPredictor
+{
+  public:
+    TagePredictor(UINT32 bits) : history(0), branches(0)
+    {
+        static const UINT32 lengths[TAGE_TABLES] = {4, 12, 28, 64};
+        base.Init(bits);
+        // the tagged tables together hold as many entries as the base table
+        indexBits = bits > 4 ? bits - 2 : 2;
+        for (UINT32 t = 0; t < TAGE_TABLES; t++)
+        {
+            historyLength[t] = lengths[t];
+            entries[t] = (UINT16 *)calloc((size_t)1 << indexBits, sizeof(UINT16));
+        }
+    }
+
+    ~TagePredictor()
+    {
+        for (UINT32 t = 0; t < TAGE_TABLES; t++)
+            free(entries[t]);
+    }
+
+    BOOL Access(UINT64 pc, BOOL taken)
+    {
+        UINT64 index[TAGE_TABLES];
+        UINT32 tag[TAGE_TABLES];
+        INT32 provider = -1, alternate = -1;
+        for (INT32 t = TAGE_TABLES - 1; t >= 0; t--)
+        {
+            UINT64 h = historyLength[t] < 64 ? history & (((UINT64)1 << historyLength[t]) - 1) : history;
+            UINT64 hash = Hash(pc, h);
+            index[t] = hash & (((UINT64)1 << indexBits) - 1);
+            tag[t] = (hash >> 48) & ((1 << TAGE_TAG_BITS) - 1);
+            if ((UINT32)(entries[t][index[t]] >> 5) != tag[t])
+                continue;
+            if (provider < 0)
+                provider = t;
+            else if (alternate < 0)
+                alternate = t;
+        }
+
+        BOOL basePredicted = base.Taken(pc);
+        BOOL alternatePredicted = alternate >= 0 ? (entries[alternate][index[alternate]] & 7) >= 4 : basePredicted;
+        BOOL predicted = basePredicted;
+        if (provider >= 0)
+        {
+            UINT16 &entry = entries[provider][index[provider]];
+            predicted = (entry & 7) >= 4;
+            UINT32 counter = entry & 7;
+            if (taken && counter < 7)
+                counter++;
+            else if (!taken && counter > 0)
+                counter--;
+            UINT32 useful = (entry >> 3) & 3;
+            if (predicted != alternatePredicted)
+            {
+                if (predicted == taken && useful < 3)
+                    useful++;
+                else if (predicted != taken && useful > 0)
+                    useful--;
+            }
+            entry = (UINT16)((entry & ~0x1f) | (useful << 3) | counter);
+        }
+        else
+            base.Update(pc, taken);
+
+        // on a misprediction take an entry with a longer history that is not useful, or age them
+        if (predicted != taken && provider < TAGE_TABLES - 1)
+        {
+            BOOL allocated = FALSE;
+            for (INT32 t = provider + 1; t < TAGE_TABLES && !allocated; t++)
+                if (((entries[t][index[t]] >> 3) & 3) == 0)
+                {
+                    entries[t][index[t]] = (UINT16)((tag[t] << 5) | (taken ? 4 : 3));
+                    allocated = TRUE;
+                }
+            for (INT32 t = provider + 1; t < TAGE_TABLES && !allocated; t++)
+                entries[t][index[t]] -= 1 << 3;
+        }
+
+        if (++branches % TAGE_RESET_PERIOD == 0)
+            AgeUseful();
+        history = (history << 1) | taken;
+        return predicted == taken;
+    }
+
+  private:
+    CounterTable base;
+    UINT16 *entries[TAGE_TABLES];
+    UINT32 historyLength[TAGE_TABLES];
+    UINT32 indexBits;
+    UINT64 history;
+    UINT64 branches;
+
+    // Index and tag both come from one mix of pc and history. Xor folding the
+    // history maps the periodic histories of loops onto the same entries.
+    static inline UINT64 Hash(UINT64 pc, UINT64 h)
+    {
+        UINT64 x = (h ^ (pc << 1)) * 0x9e3779b97f4a7c15ULL;
+        x ^= x >> 29;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        return x ^ (x >> 32);
+    }
+
+    // halve every useful counter so that stale entries can be replaced
+    VOID AgeUseful()
+    {
+        for (UINT32 t = 0; t < TAGE_TABLES; t++)
+            for (UINT64 i = 0; i < ((UINT64)1 << indexBits); i++)
+            {
+                UINT16 &entry = entries[t][i];
+                entry = (UINT16)((entry & ~0x18) | ((((entry >> 3) & 3) >> 1) << 3));
+            }
+    }
+};
+
+inline DirectionPredictor *CreateDirectionPredictor(UINT32 kind, UINT32 bits)
+{
+    switch (kind)
+    {
+    case BRANCH_PREDICTOR_BIMODAL:
+        return new BimodalPredictor(bits);
+    case BRANCH_PREDICTOR_GSHARE:
+        return new GsharePredictor(bits);
+    default:
+        return new TagePredictor(bits);
+    }
+}
+
+// Direction predictors, BTB and return address stack of one thread
+class alignas(8) BranchModel // counters read by -progress, see InstMetrics
+{
+  public:
+    UINT64 condBranches;
+    UINT64 condMisses[MAX_BRANCH_PREDICTORS]; // per configured predictor
+    UINT64 indirectBranches;
+    UINT64 indirectMisses;
+    UINT64 returns;
+    UINT64 returnMisses;
+
+    BranchModel() : numPredictors(0), btbPcs(0), btbTargets(0), btbMask(0), rasSize(0), rasTop(0), rasDepth(0)
+    {
+        ResetStats();
+        for (UINT32 i = 0; i < MAX_BRANCH_PREDICTORS; i++)
+            predictors[i] = 0;
+    }
+    BranchModel(const BranchModel &) = delete;
+    BranchModel &operator=(const BranchModel &) = delete;
+
+    ~BranchModel()
+    {
+        for (UINT32 i = 0; i < numPredictors; i++)
+            delete predictors[i];
+        free(btbPcs);
+        free(btbTargets);
+    }
+
+    VOID Init(const UINT32 *kinds, UINT32 count, UINT32 tableBits, UINT32 btbBits, UINT32 stackSize)
+    {
+        numPredictors = count;
+        for (UINT32 i = 0; i < count; i++)
+            predictors[i] = CreateDirectionPredictor(kinds[i], tableBits);
+        btbPcs = (UINT64 *)calloc((size_t)1 << btbBits, sizeof(UINT64));
+        btbTargets = (UINT64 *)calloc((size_t)1 << btbBits, sizeof(UINT64));
+        btbMask = ((UINT64)1 << btbBits) - 1;
+        rasSize = stackSize < MAX_RAS_SIZE ? stackSize : MAX_RAS_SIZE;
+    }
+
+    inline VOID Conditional(UINT64 pc, BOOL taken)
+    {
+        condBranches++;
+        for (UINT32 i = 0; i < numPredictors; i++)
+            if (!predictors[i]->Access(pc, taken))
+                condMisses[i]++;
+    }
+
+    // Indirect jump or call, the BTB holds the last target of every slot
+    inline VOID Indirect(UINT64 pc, UINT64 target)
+    {
+        indirectBranches++;
+        UINT64 slot = (pc ^ (pc >> 12)) & btbMask;
+        if (btbPcs[slot] != pc || btbTargets[slot] != target)
+            indirectMisses++;
+        btbPcs[slot] = pc;
+        btbTargets[slot] = target;
+    }
+
+    inline VOID Call(UINT64 returnAddress)
+    {
+        if (rasSize == 0)
+            return;
+        rasTop = (rasTop + 1) % rasSize;
+        ras[rasTop] = returnAddress;
+        if (rasDepth < rasSize)
+            rasDepth++;
+    }
+
+    // An empty stack, after an overflow for instance, mispredicts
+    inline VOID Return(UINT64 target)
+    {
+        returns++;
+        if (rasDepth == 0)
+        {
+            returnMisses++;
+            return;
+        }
+        if (ras[rasTop] != target)
+            returnMisses++;
+        rasTop = (rasTop + rasSize - 1) % rasSize;
+        rasDepth--;
+    }
+
+    // Mispredictions charged to the CPI: the first predictor, the BTB and the stack
+    inline UINT64 Mispredictions() const
+    {
+        return condMisses[0] + indirectMisses + returnMisses;
+    }
+
+    VOID ResetStats()
+    {
+        condBranches = 0;
+        for (UINT32 i = 0; i < MAX_BRANCH_PREDICTORS; i++)
+            condMisses[i] = 0;
+        indirectBranches = 0;
+        indirectMisses = 0;
+        returns = 0;
+        returnMisses = 0;
+    }
+
+    VOID MergeStats(const BranchModel &other)
+    {
+        condBranches += other.condBranches;
+        for (UINT32 i = 0; i < MAX_BRANCH_PREDICTORS; i++)
+            condMisses[i] += other.condMisses[i];
+        indirectBranches += other.indirectBranches;
+        indirectMisses += other.indirectMisses;
+        returns += other.returns;
+        returnMisses += other.returnMisses;
+    }
+
+  private:
+    DirectionPredictor *predictors[MAX_BRANCH_PREDICTORS];
+    UINT32 numPredictors;
+    UINT64 *btbPcs;
+    UINT64 *btbTargets;
+    UINT64 btbMask;
+    UINT64 ras[MAX_RAS_SIZE];
+    UINT32 rasSize;
+    UINT32 rasTop;
+    UINT32 rasDepth;
+};
+
+#endif
@@ -0,0 +1,338 @@
+/*
+ * Set associative cache model used for the PART B CPI.
+ *
+ * Every level keeps its tags in one flat array, assoc tags per set, with no
+ * per way valid or dirty bits: an empty way holds CACHE_INVALID_TAG. Set and
+ * tag come from shifts and masks, so sizes, ways and lines are powers of two
+ * (ways only for the tree PLRU policy). Writes allocate like reads and write
+ * backs are not modelled.
+ */
+
+#ifndef HW1_CACHE_H
+#define HW1_CACHE_H
+
+#include "HW1Types.h"
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define CACHE_INVALID_TAG (~(UINT64)0)
+
+enum
+{
+    CACHE_POLICY_LRU = 0,
+    CACHE_POLICY_PLRU = 1,
+    CACHE_POLICY_FIFO = 2,
+    CACHE_POLICY_RANDOM = 3
+};
+
+#define CACHE_LEVELS 4
+enum
+{
+    CACHE_L1D = 0,
+    CACHE_L1I = 1,
+    CACHE_L2 = 2,
+    CACHE_LLC = 3
+};
+const char *const cacheLevelNames[CACHE_LEVELS] = {"L1D", "L1I", "L2", "LLC"};
+
+// Geometry and latency of one level, a size of 0 disables the level (L2 and LLC only)
+typedef struct _CacheConfig
+{
+    UINT32 sizeKB;
+    UINT32 assoc;
+    UINT32 lineSize;
+    UINT32 latency;
+} CacheConfig;
+
+inline BOOL IsPowerOfTwo(UINT64 x)
+{
+    return x != 0 && (x & (x - 1)) == 0;
+}
+
+inline UINT32 Log2(UINT64 x)
+{
+    return 63 - __builtin_clzll(x);
+}
+
+// Parse size:assoc:line:latency, e.g. 32:8:64:1 for a 32KB 8 way cache with 64 byte lines.
+// Size 0 is only accepted for an optional level, the L1s are always there.
+inline BOOL ParseCacheConfig(const std::string &spec, CacheConfig &config, BOOL optional)
+{
+    if (sscanf(spec.c_str(), "%u:%u:%u:%u", &config.sizeKB, &config.assoc, &config.lineSize, &config.latency) != 4)
+        return FALSE;
+    if (config.sizeKB == 0)
+        return optional;
+    if (config.assoc == 0 || config.assoc > 64 || !IsPowerOfTwo(config.lineSize) || config.lineSize < 4)
+        return FALSE;
+    UINT64 lines = (UINT64)config.sizeKB * 1024 / config.lineSize;
+    return lines % config.assoc == 0 && IsPowerOfTwo(lines / config.assoc);
+}
+
+inline BOOL ParseCachePolicy(const std::string &name, UINT32 &policy)
+{
+    if (name == "lru")
+        policy = CACHE_POLICY_LRU;
+    else if (name == "plru")
+        policy = CACHE_POLICY_PLRU;
+    else if (name == "fifo")
+        policy = CACHE_POLICY_FIFO;
+    else if (name == "random")
+        policy = CACHE_POLICY_RANDOM;
+    else
+        return FALSE;
+    return TRUE;
+}
+
+class alignas(8) Cache // counters read by -progress, see InstMetrics
+{
+  public:
+    UINT64 accesses;
+    UINT64 misses;
+
+    Cache() : accesses(0), misses(0), tags(0), plru(0), assoc(0), policy(0), lineBits(0), setMask(0), random(0x9e3779b9) {}
+    Cache(const Cache &) = delete;
+    Cache &operator=(const Cache &) = delete;
+
+    ~Cache()
+    {
+        free(tags);
+        free(plru);
+    }
+
+    VOID Init(const CacheConfig &config, UINT32 replacementPolicy)
+    {
+        if (config.sizeKB == 0)
+            return;
+        UINT64 sets = (UINT64)config.sizeKB * 1024 / config.lineSize / config.assoc;
+        assoc = config.assoc;
+        policy = replacementPolicy;
+        // tree PLRU needs a power of two number of ways
+        if (policy == CACHE_POLICY_PLRU && !IsPowerOfTwo(assoc))
+            policy = CACHE_POLICY_LRU;
+        lineBits = Log2(config.lineSize);
+        setMask = sets - 1;
+        tags = (UINT64 *)malloc(sets * assoc * sizeof(UINT64));
+        memset(tags, 0xff, sets * assoc * sizeof(UINT64));
+        if (policy == CACHE_POLICY_PLRU)
+            plru = (UINT64 *)calloc(sets, sizeof(UINT64));
+    }
+
+    inline BOOL Enabled() const
+    {
+        return tags != 0;
+    }
+
+    inline UINT32 LineBits() const
+    {
+        return lineBits;
+    }
+
+    // Look up the line holding addr and fill it on a miss, returns TRUE on a hit
+    inline BOOL Access(UINT64 addr)
+    {
+        accesses++;
+        UINT64 line = addr >> lineBits;
+        UINT64 index = line & setMask;
+        UINT64 *set = tags + index * assoc;
+        for (UINT32 way = 0; way < assoc; way++)
+        {
+            if (set[way] != line)
+                continue;
+            if (policy == CACHE_POLICY_LRU && way != 0)
+            {
+                // ways are kept in recency order, most recent first
+                memmove(set + 1, set, way * sizeof(UINT64));
+                set[0] = line;
+            }
+            else if (policy == CACHE_POLICY_PLRU)
+                TouchPlru(index, way);
+            return TRUE;
+        }
+        misses++;
+        Fill(index, set, line);
+        return FALSE;
+    }
+
+    // Lookup without counting or touching the replacement state
+    inline BOOL Contains(UINT64 addr) const
+    {
+        UINT64 line = addr >> lineBits;
+        const UINT64 *set = tags + (line & setMask) * assoc;
+        for (UINT32 way = 0; way < assoc; way++)
+            if (set[way] == line)
+                return TRUE;
+        return FALSE;
+    }
+
+    VOID ResetStats()
+    {
+        accesses = 0;
+        misses = 0;
+    }
+
+    VOID MergeStats(const Cache &other)
+    {
+        accesses += other.accesses;
+        misses += other.misses;
+    }
+
+  private:
+    UINT64 *tags;
+    UINT64 *plru; // one tree of assoc - 1 bits per set, node i at bit i (root is 1)
+    UINT32 assoc;
+    UINT32 policy;
+    UINT32 lineBits;
+    UINT64 setMask;
+    UINT32 random;
+
+    inline VOID Fill(UINT64 index, UINT64 *set, UINT64 line)
+    {
+        UINT32 way;
+        switch (policy)
+        {
+        case CACHE_POLICY_PLRU:
+            way = VictimPlru(index);
+            set[way] = line;
+            TouchPlru(index, way);
+            return;
+        case CACHE_POLICY_RANDOM:
+            for (way = 0; way < assoc; way++)
+                if (set[way] == CACHE_INVALID_TAG)
+                {
+                    set[way] = line;
+                    return;
+                }
+            // xorshift32, scaled to [0, assoc) with a multiply instead of a modulo
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            set[((UINT64)random * assoc) >> 32] = line;
+            return;
+        default:
+            // LRU and FIFO both insert at the front and drop the last way
+            memmove(set + 1, set, (assoc - 1) * sizeof(UINT64));
+            set[0] = line;
+            return;
+        }
+    }
+
+    // Walk to the way and make every node on the path point away from it
+    inline VOID TouchPlru(UINT64 index, UINT32 way)
+    {
+        UINT64 bits = plru[index];
+        UINT32 node = 1;
+        for (UINT32 level = Log2(assoc); level > 0; level--)
+        {
+            UINT32 right = (way >> (level - 1)) & 1;
+            if (right)
+                bits &= ~((UINT64)1 << node);
+            else
+                bits |= (UINT64)1 << node;
+            node = 2 * node + right;
+        }
+        plru[index] = bits;
+    }
+
+    inline UINT32 VictimPlru(UINT64 index) const
+    {
+        UINT64 bits = plru[index];
+        UINT32 node = 1;
+        while (node < assoc)
+            node = 2 * node + ((bits >> node) & 1);
+        return node - assoc;
+    }
+};
+
+// L1D and L1I in front of a unified L2 and LLC. Every access is charged the
+// latency of the level that serves it, memory beyond the LLC costs memLatency.
+// Instruction fetches that hit the L1I are free, they are the base cycle.
+class CacheHierarchy
+{
+  public:
+    Cache level[CACHE_LEVELS];
+    UINT64 dataCycles;
+    UINT64 fetchCycles;
+
+    CacheHierarchy() : dataCycles(0), fetchCycles(0), enabled(FALSE), memLatency(0)
+    {
+        for (UINT32 i = 0; i < CACHE_LEVELS; i++)
+            latency[i] = 0;
+    }
+
+    VOID Init(const CacheConfig *configs, UINT32 policy, UINT32 memoryLatency)
+    {
+        for (UINT32 i = 0; i < CACHE_LEVELS; i++)
+        {
+            level[i].Init(configs[i], policy);
+            latency[i] = configs[i].latency;
+        }
+        memLatency = memoryLatency;
+        enabled = TRUE;
+    }
+
+    inline VOID Data(UINT64 addr, UINT32 size)
+    {
+        if (!enabled || size == 0)
+            return;
+        Cache &l1d = level[CACHE_L1D];
+        if (!l1d.Enabled())
+        {
+            dataCycles += Lower(addr);
+            return;
+        }
+        UINT32 bits = l1d.LineBits();
+        for (UINT64 line = addr >> bits; line <= (addr + size - 1) >> bits; line++)
+            dataCycles += l1d.Access(line << bits) ? latency[CACHE_L1D] : Lower(line << bits);
+    }
+
+    inline VOID Fetch(UINT64 addr, UINT32 size)
+    {
+        if (!enabled || size == 0)
+            return;
+        Cache &l1i = level[CACHE_L1I];
+        if (!l1i.Enabled())
+        {
+            fetchCycles += Lower(addr);
+            return;
+        }
+        UINT32 bits = l1i.LineBits();
+        for (UINT64 line = addr >> bits; line <= (addr + size - 1) >> bits; line++)
+            if (!l1i.Access(line << bits))
+                fetchCycles += Lower(line << bits);
+    }
+
+    VOID ResetStats()
+    {
+        for (UINT32 i = 0; i < CACHE_LEVELS; i++)
+            level[i].ResetStats();
+        dataCycles = 0;
+        fetchCycles = 0;
+    }
+
+    VOID MergeStats(const CacheHierarchy &other)
+    {
+        for (UINT32 i = 0; i < CACHE_LEVELS; i++)
+            level[i].MergeStats(other.level[i]);
+        dataCycles += other.dataCycles;
+        fetchCycles += other.fetchCycles;
+    }
+
+  private:
+    BOOL enabled;
+    UINT32 latency[CACHE_LEVELS];
+    UINT32 memLatency;
+
+    // Latency of an L1 miss
+    inline UINT32 Lower(UINT64 addr)
+    {
+        if (level[CACHE_L2].Enabled() && level[CACHE_L2].Access(addr))
+            return latency[CACHE_L2];
+        if (level[CACHE_LLC].Enabled() && level[CACHE_LLC].Access(addr))
+            return latency[CACHE_LLC];
+        return memLatency;
+    }
+};
+
+#endif
@@ -0,0 +1,878 @@
+/*
+ * Pin independent analysis core of the HW1 tool: the Part A-D metrics of one
+ * thread, the basic block records they are folded from, and the report.
+ * Shared by the pin tool and the standalone trace replay (HW1Replay).
+ */
+
+#ifndef HW1_CORE_H
+#define HW1_CORE_H
+
+#include "HW1Types.h"
+#include "HW1Cache.h"
+#include "HW1Branch.h"
+#include "HW1Reuse.h"
+#include "HW1Prefetch.h"
+#include "HW1Timing.h"
+#include "HW1Tlb.h"
+#include "HW1Footprint.h"
+#include <ostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <climits>
+
+using std::unordered_set;
+using std::vector;
+
+#define RECORDFOOTPRINT(startaddr, size, container)                                                                                         \
+    do                                                                                                                                      \
+    {                                                                                                                                       \
+        for (UINT64 addr = (UINT64)startaddr / 32; addr < ((UINT64)startaddr + size) / 32 + (((UINT64)startaddr + size) % 32 != 0); addr++) \
+            container.Insert(addr);                                                                                                         \
+    } while (0)
+
+// 8 byte aligned on ia32 too, so -progress can load each counter at once
+typedef struct alignas(8) _InstMetrics
+{
+    UINT64 numLoads = 0;
+    UINT64 numStores = 0;
+    UINT64 numNops = 0;
+    UINT64 numDirectCalls = 0;
+    UINT64 numIndirectCalls = 0;
+    UINT64 numReturns = 0;
+    UINT64 numUncondBranches = 0;
+    UINT64 numCondBranches = 0;
+    UINT64 numLogicalOps = 0;
+    UINT64 numRotateShift = 0;
+    UINT64 numFlagOps = 0;
+    UINT64 numVector = 0;
+    UINT64 numCondMoves = 0;
+    UINT64 numMMXSSE = 0;
+    UINT64 numSysCalls = 0;
+    UINT64 numFP = 0;
+    UINT64 numRest = 0;
+} InstMetrics;
+
+#define INST_METRICS_COUNTERS (sizeof(InstMetrics) / sizeof(UINT64))
+// column names for the binary results, in InstMetrics order
+const char *const instMetricsNames[] = {"loads", "stores", "nops", "direct_calls", "indirect_calls", "returns",
+                                        "uncond_branches", "cond_branches", "logical_ops", "rotate_shift", "flag_ops",
+                                        "vector", "cond_moves", "mmx_sse", "syscalls", "fp", "rest"};
+// category counter selected in Trace(), stored as an offset so it works for every thread
+#define INS_TYPE_COUNTER(m, offset) (*(UINT64 *)((UINT8 *)&(m)->instMetrics + (offset)))
+
+// Metric groups selected by -metrics. The record functions and the analysis
+// routines are templates on a mask of them, so a disabled group costs nothing.
+enum
+{
+    METRIC_MIX = 1,       // PART A categories, loads and stores, the PART B CPI
+    METRIC_FOOTPRINT = 2, // PART C footprints, also fed to -reuse and -hot
+    METRIC_PARTD = 4,     // PART D distributions and extremes
+    METRIC_CACHE = 8,     // data accesses of the cache model, set by -cache
+    METRIC_TIMING = 16,   // latencies of the data accesses for the timing model, set by -timing
+    METRIC_TLB = 32,      // data accesses of the TLB model, set by -tlb
+    METRIC_MASKS = 64
+};
+#define METRIC_ALL (METRIC_MIX | METRIC_FOOTPRINT | METRIC_PARTD | METRIC_CACHE)
+#define METRIC_GROUPS (METRIC_MIX | METRIC_FOOTPRINT | METRIC_PARTD)
+
+// Parse a list like mix,partd, or all
+inline BOOL ParseMetricGroups(const std::string &list, UINT32 &mask)
+{
+    mask = 0;
+    size_t begin = 0;
+    while (begin <= list.size())
+    {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string name = list.substr(begin, end - begin);
+        if (name == "mix")
+            mask |= METRIC_MIX;
+        else if (name == "footprint")
+            mask |= METRIC_FOOTPRINT;
+        else if (name == "partd")
+            mask |= METRIC_PARTD;
+        else if (name == "all")
+            mask |= METRIC_GROUPS;
+        else
+            return FALSE;
+        begin = end + 1;
+    }
+    return mask != 0;
+}
+
+// Calls f.Run<MASK>() with the template argument equal to a run time mask
+template <class F, UINT32 MASK = METRIC_MASKS - 1>
+struct MetricDispatch
+{
+    static inline VOID Run(UINT32 mask, F &f)
+    {
+        if (mask == MASK)
+            f.template Run<MASK>();
+        else
+            MetricDispatch<F, MASK - 1>::Run(mask, f);
+    }
+};
+
+template <class F>
+struct MetricDispatch<F, 0>
+{
+    static inline VOID Run(UINT32, F &f)
+    {
+        f.template Run<0>();
+    }
+};
+
+// Flat counter array for small bounded keys, the last bucket collects overflow
+template <UINT32 N>
+struct alignas(64) Histogram
+{
+    UINT64 bucket[N + 1] = {};
+
+    inline VOID Record(UINT32 key, UINT64 count = 1)
+    {
+        bucket[key < N ? key : N] += count;
+    }
+
+    VOID Merge(const Histogram &other)
+    {
+        for (UINT32 i = 0; i <= N; i++)
+            bucket[i] += other.bucket[i];
+    }
+};
+
+#define HIST_BUCKETS 32
+
+// Static contribution of one instruction, computed once in Trace(). Only fixed width
+// fields, so ia32 and intel64 builds agree on the layout of the -trace static file.
+typedef struct _InsSummary
+{
+    UINT64 insAddr;
+    UINT32 insSize;
+    UINT32 operandsCount;
+    UINT32 regReadCount;
+    UINT32 regWriteCount;
+    INT64 immediateMin;
+    INT64 immediateMax;
+    // predicated part, counted here only if the instruction always executes
+    UINT32 predicated;
+    UINT32 insTypeOffset;
+    UINT32 memOperands;
+    UINT32 numLoads;
+    UINT32 numStores;
+    UINT32 readOperands;
+    UINT32 writeOperands;
+    UINT32 memTouched;
+    INT64 displacementMax;
+    INT64 displacementMin;
+} InsSummary;
+static_assert(sizeof(InsSummary) == 88, "InsSummary layout is part of the trace format");
+
+// Per basic block record, folded into the metrics as execution count * deltas
+typedef struct _BblSummary
+{
+    UINT32 id;     // 1-based index into the per thread execution counts
+    UINT32 numIns; // all instructions, for weighting the basic block vectors
+    std::vector<InsSummary> ins;
+    std::vector<TimingIns> timing; // -timing only
+} BblSummary;
+
+// Part A-D state of one thread. Each thread only updates its own shard, so the
+// analysis routines take no locks; shards are merged when a window is reported.
+// Shards are cache line aligned and sized so two threads never share a line.
+typedef struct alignas(64) _Metrics
+{
+    // instruction counting, see SyncCount()
+    UINT64 pending = 0;   // instructions not yet added to the global insCount
+    UINT64 budget = 0;    // instructions between syncs, the tool's budget register counts them down
+    UINT64 insCount = 0;  // instructions of this thread already added to insCount
+    UINT64 windowIns = 0; // those of them past the start of the current window
+    UINT32 tid = 0;
+    // PART A+B
+    InstMetrics instMetrics;
+    CacheHierarchy caches; // contents stay warm across windows, only the statistics restart
+    BranchModel branches;  // same for the predictor tables
+    PrefetchModel prefetch; // same for its L1D and tables
+    TimingModel timing;     // same for the pipeline
+    TlbModel tlb;           // same for the TLBs
+    const BblSummary *timedBlock = 0; // block whose data access latencies the timing model is collecting
+    Footprint prefetchable; // data blocks -prefetch found prefetchable
+    // PART C
+    Footprint dataFootprint;
+    Footprint insFootprint;
+    ReuseProfile reuse; // data blocks, the followed blocks stay across windows
+    // PART D
+    Histogram<16> insLengthHist; // x86 instructions are at most 15 bytes
+    Histogram<HIST_BUCKETS> insOperandsHist;
+    Histogram<HIST_BUCKETS> insRegReadHist;
+    Histogram<HIST_BUCKETS> insRegWriteHist;
+    Histogram<HIST_BUCKETS> insMemOperandsHist;
+    Histogram<HIST_BUCKETS> insMemReadHist;
+    Histogram<HIST_BUCKETS> insMemWriteHist;
+    UINT64 insMemTouched = 0;
+    UINT64 insMemTouchedMax = 0;
+    INT64 immediateMax = INT64_MIN;
+    INT64 immediateMin = INT64_MAX;
+    INT64 displacementMax = INT64_MIN;
+    INT64 displacementMin = INT64_MAX;
+    // BBL summary mode: execution count per block id
+    vector<UINT64> bblExec;
+    // hot code profile: data blocks first touched in the window by each block id
+    BOOL attributeData = FALSE;
+    // metric groups folded from the block records, see FoldBlock()
+    UINT32 metrics = METRIC_ALL;
+    vector<UINT64> blockDataTouches;
+    // -layout: taken executions of the conditional branch ending each block id
+    vector<UINT64> blockTaken;
+
+    static VOID *operator new(size_t size)
+    {
+        VOID *p = 0;
+        if (posix_memalign(&p, 64, size) != 0)
+            abort();
+        return p;
+    }
+
+    // out of line so the compiler does not pair free with the new expression
+    static __attribute__((noinline)) VOID operator delete(VOID *p)
+    {
+        free(p);
+    }
+
+    // Exact block sets up to budgetBytes each, then HyperLogLog sketches of 2^sketchBits registers
+    VOID InitFootprints(UINT64 budgetBytes, UINT32 sketchBits)
+    {
+        dataFootprint.Init(budgetBytes, sketchBits);
+        insFootprint.Init(budgetBytes, sketchBits);
+        prefetchable.Init(budgetBytes, sketchBits);
+    }
+
+    // Start a new window from zero, instruction counting is left alone
+    VOID Reset()
+    {
+        windowIns = 0;
+        instMetrics = InstMetrics();
+        caches.ResetStats();
+        branches.ResetStats();
+        prefetch.ResetStats();
+        timing.ResetStats();
+        tlb.ResetStats();
+        reuse.ResetStats();
+        dataFootprint.Clear();
+        prefetchable.Clear();
+        insFootprint.Clear();
+        insLengthHist = Histogram<16>();
+        insOperandsHist = Histogram<HIST_BUCKETS>();
+        insRegReadHist = Histogram<HIST_BUCKETS>();
+        insRegWriteHist = Histogram<HIST_BUCKETS>();
+        insMemOperandsHist = Histogram<HIST_BUCKETS>();
+        insMemReadHist = Histogram<HIST_BUCKETS>();
+        insMemWriteHist = Histogram<HIST_BUCKETS>();
+        insMemTouched = 0;
+        insMemTouchedMax = 0;
+        immediateMax = INT64_MIN;
+        immediateMin = INT64_MAX;
+        displacementMax = INT64_MIN;
+        displacementMin = INT64_MAX;
+        std::fill(bblExec.begin(), bblExec.end(), 0);
+        std::fill(blockDataTouches.begin(), blockDataTouches.end(), 0);
+        std::fill(blockTaken.begin(), blockTaken.end(), 0);
+    }
+
+    // Static part of n executions of one instruction
+    template <UINT32 MASK = METRIC_ALL>
+    inline VOID RecordIns(UINT64 insAddr, UINT32 insSize, UINT32 operandsCount, UINT32 regReadCount, UINT32 regWriteCount,
+                          INT64 insImmediateMin, INT64 insImmediateMax, UINT64 n = 1)
+    {
+        if (MASK & METRIC_FOOTPRINT)
+            RECORDFOOTPRINT(insAddr, insSize, insFootprint);
+        if (!(MASK & METRIC_PARTD))
+            return;
+        insLengthHist.Record(insSize, n);
+        insOperandsHist.Record(operandsCount, n);
+        insRegReadHist.Record(regReadCount, n);
+        insRegWriteHist.Record(regWriteCount, n);
+        if (insImmediateMin < immediateMin)
+            immediateMin = insImmediateMin;
+        if (insImmediateMax > immediateMax)
+            immediateMax = insImmediateMax;
+    }
+
+    // Predicated part of n executions of an instruction with memory operands
+    template <UINT32 MASK = METRIC_ALL>
+    inline VOID RecordMemIns(UINT32 insTypeOffset, UINT32 numLoads, UINT32 numStores, UINT32 readOperands, UINT32 writeOperands,
+                             INT64 insDisplacementMax, INT64 insDisplacementMin, UINT64 n = 1)
+    {
+        if (MASK & METRIC_MIX)
+        {
+            INS_TYPE_COUNTER(this, insTypeOffset) += n;
+            instMetrics.numLoads += n * numLoads;
+            instMetrics.numStores += n * numStores;
+        }
+        if (!(MASK & METRIC_PARTD))
+            return;
+        insMemOperandsHist.Record(readOperands + writeOperands, n);
+        insMemReadHist.Record(readOperands, n);
+        insMemWriteHist.Record(writeOperands, n);
+        if (displacementMin > insDisplacementMin)
+            displacementMin = insDisplacementMin;
+        if (displacementMax < insDisplacementMax)
+            displacementMax = insDisplacementMax;
+    }
+
+    // Predicated part of one execution of an instruction without memory operands
+    template <UINT32 MASK = METRIC_ALL>
+    inline VOID RecordNoMemIns(UINT32 insTypeOffset)
+    {
+        if (MASK & METRIC_MIX)
+            INS_TYPE_COUNTER(this, insTypeOffset) += 1;
+        if (!(MASK & METRIC_PARTD))
+            return;
+        insMemOperandsHist.bucket[0]++;
+        insMemReadHist.bucket[0]++;
+        insMemWriteHist.bucket[0]++;
+    }
+
+    // Bytes accessed by n executions of a memory instruction
+    template <UINT32 MASK = METRIC_ALL>
+    inline VOID RecordMemTouched(UINT32 bytes, UINT64 n = 1)
+    {
+        if (!(MASK & METRIC_PARTD))
+            return;
+        insMemTouched += n * bytes;
+        if (bytes > insMemTouchedMax)
+            insMemTouchedMax = bytes;
+    }
+
+    // One memory operand of an instruction in block id: data footprint, reuse profile and caches
+    template <UINT32 MASK = METRIC_ALL>
+    inline VOID RecordData(UINT64 ea, UINT32 size, UINT32 block = 0)
+    {
+        if (MASK & METRIC_FOOTPRINT)
+        {
+            if (attributeData && block)
+                AttributeData(ea, size, block);
+            else
+                RECORDFOOTPRINT(ea, size, dataFootprint);
+            if (reuse.Enabled())
+                RECORDFOOTPRINT(ea, size, reuse);
+        }
+        if ((MASK & METRIC_CACHE) && (MASK & METRIC_TIMING))
+        {
+            UINT64 cycles = caches.dataCycles;
+            caches.Data(ea, size);
+            timing.Latency(caches.dataCycles - cycles);
+        }
+        else if (MASK & METRIC_CACHE)
+            caches.Data(ea, size);
+        if (MASK & METRIC_TLB)
+            tlb.Data(ea, size);
+    }
+
+    // Instruction fetch of a basic block, through the L1I and the ITLB
+    inline VOID RecordFetch(UINT64 addr, UINT32 size)
+    {
+        caches.Fetch(addr, size);
+        tlb.Fetch(addr, size);
+    }
+
+    // -timing: the previous block has run and queued its latencies, the next one starts
+    inline VOID TimeBlock(const BblSummary *summary)
+    {
+        if (timedBlock)
+            timing.Block(timedBlock->timing);
+        timedBlock = summary;
+    }
+
+    // -timing: run the last block before a window or thread ends, there is no next one to do it
+    inline VOID FlushTimedBlock()
+    {
+        TimeBlock(0);
+    }
+
+    // One data access for -prefetch, flags are PREFETCH_READ and PREFETCH_CHASE
+    inline VOID RecordPrefetch(UINT64 pc, UINT64 ea, UINT32 size, UINT32 flags)
+    {
+        if (prefetch.Access(pc, ea, size, flags))
+            RECORDFOOTPRINT(ea, size, prefetchable);
+    }
+
+    // Footprint of one access, counting the blocks it touches first for the block id
+    VOID AttributeData(UINT64 ea, UINT32 size, UINT32 block)
+    {
+        if (block >= blockDataTouches.size())
+            blockDataTouches.resize(2 * block + 1, 0);
+        for (UINT64 addr = ea / 32; addr < (ea + size) / 32 + ((ea + size) % 32 != 0); addr++)
+            blockDataTouches[block] += dataFootprint.Insert(addr);
+    }
+
+    // n executions of a basic block record, except for the footprint and caches of its data accesses
+    template <UINT32 MASK>
+    VOID FoldBlockAs(const BblSummary *summary, UINT64 n)
+    {
+        for (auto ins = summary->ins.begin(); ins != summary->ins.end(); ins++)
+        {
+            RecordIns<MASK>(ins->insAddr, ins->insSize, ins->operandsCount, ins->regReadCount, ins->regWriteCount,
+                            ins->immediateMin, ins->immediateMax, n);
+            if (ins->predicated)
+                continue;
+            // without memory operands the displacement range is empty and this only counts the category
+            RecordMemIns<MASK>(ins->insTypeOffset, ins->numLoads, ins->numStores, ins->readOperands, ins->writeOperands,
+                               ins->displacementMax, ins->displacementMin, n);
+            if (ins->memOperands)
+                RecordMemTouched<MASK>(ins->memTouched, n);
+        }
+    }
+
+    struct FoldBlockCall
+    {
+        _Metrics *m;
+        const BblSummary *summary;
+        UINT64 n;
+        template <UINT32 MASK>
+        VOID Run()
+        {
+            m->FoldBlockAs<MASK>(summary, n);
+        }
+    };
+
+    // Same for the groups in metrics
+    VOID FoldBlock(const BblSummary *summary, UINT64 n)
+    {
+        FoldBlockCall call = {this, summary, n};
+        MetricDispatch<FoldBlockCall, METRIC_GROUPS>::Run(metrics & METRIC_GROUPS, call);
+    }
+
+    // Add another shard, every metric is a sum, a set union or a min/max
+    VOID Merge(const _Metrics &other)
+    {
+        for (UINT32 i = 0; i < INST_METRICS_COUNTERS; i++)
+            ((UINT64 *)&instMetrics)[i] += ((const UINT64 *)&other.instMetrics)[i];
+        caches.MergeStats(other.caches);
+        branches.MergeStats(other.branches);
+        prefetch.MergeStats(other.prefetch);
+        timing.MergeStats(other.timing);
+        tlb.MergeStats(other.tlb);
+        reuse.MergeStats(other.reuse);
+        dataFootprint.Merge(other.dataFootprint);
+        prefetchable.Merge(other.prefetchable);
+        insFootprint.Merge(other.insFootprint);
+        insLengthHist.Merge(other.insLengthHist);
+        insOperandsHist.Merge(other.insOperandsHist);
+        insRegReadHist.Merge(other.insRegReadHist);
+        insRegWriteHist.Merge(other.insRegWriteHist);
+        insMemOperandsHist.Merge(other.insMemOperandsHist);
+        insMemReadHist.Merge(other.insMemReadHist);
+        insMemWriteHist.Merge(other.insMemWriteHist);
+        insMemTouched += other.insMemTouched;
+        insMemTouchedMax = std::max(insMemTouchedMax, other.insMemTouchedMax);
+        immediateMax = std::max(immediateMax, other.immediateMax);
+        immediateMin = std::min(immediateMin, other.immediateMin);
+        displacementMax = std::max(displacementMax, other.displacementMax);
+        displacementMin = std::min(displacementMin, other.displacementMin);
+    }
+} Metrics;
+
+// What the report says about the window besides the metrics
+typedef struct _ReportInfo
+{
+    std::string outputFile;
+    UINT64 insCount;
+    UINT64 windowStart;
+    UINT32 windowIndex;
+    UINT32 numWindows;
+    const CacheConfig *cacheConfigs; // 0 without the cache model
+    std::string cachePolicy;
+    UINT32 memLatency;
+    const UINT32 *branchPredictors; // kinds in report order, 0 without the branch model
+    UINT32 numBranchPredictors;
+    UINT32 branchPenalty;
+    UINT32 prefetchDegree; // 0 without the prefetch model
+    UINT32 robSize;        // 0 without the timing model
+    const TlbConfig *tlbConfigs; // TLB_DTLB, TLB_ITLB, TLB_STLB, 0 without the TLB model
+    UINT32 pageWalk;
+    UINT32 issueWidth;
+    FLT64 reuseRate; // -reuse_sample rate asked for, 0 without the reuse profile
+    UINT64 reuseInterval;
+    UINT32 metrics; // METRIC_ groups measured
+    UINT32 addressBits; // of the measured program, 32 keeps the ia32 report format
+    std::chrono::time_point<std::chrono::system_clock> startTime;
+} ReportInfo;
+
+#define PRINT_METRICS(name, total)                                                    \
+    std::setw(10) << std::right << name << " (" << std::fixed << std::setprecision(2) \
+                  << std::setw(5) << std::right << (100.0 * name / total) << "%"      \
+                  << ")" << std::endl
+
+template <UINT32 N>
+VOID PrintHistogram(std::ostream &out, const Histogram<N> &hist, const std::string &unit)
+{
+    for (UINT32 i = 0; i < N; i++)
+        if (hist.bucket[i])
+            out << "Number of Instruction of " << i << unit << ": " << hist.bucket[i] << std::endl;
+    if (hist.bucket[N])
+        out << "Number of Instruction of " << N << "+" << unit << ": " << hist.bucket[N] << std::endl;
+}
+
+inline UINT64 InstMetricsTotal(const InstMetrics &instMetrics)
+{
+    UINT64 total = 0;
+    for (UINT32 i = 0; i < INST_METRICS_COUNTERS; i++)
+        total += ((const UINT64 *)&instMetrics)[i];
+    return total;
+}
+
+// CPI numloads You should charge each load and store operation a fixed latency of
+// seventy cycles and every other instruction a latency of one cycle.
+inline FLT64 FlatCpi(const InstMetrics &instMetrics, UINT64 total)
+{
+    return (instMetrics.numLoads + instMetrics.numStores) * 70.0 / total + (total - instMetrics.numLoads - instMetrics.numStores) * 1.0 / total;
+}
+
+// CPI of the cache model: one cycle per instruction, plus the latency of the level
+// serving every data access, plus the latency below the L1I of every fetch miss.
+inline FLT64 CacheCpi(const CacheHierarchy &caches, UINT64 total)
+{
+    return (total + caches.dataCycles + caches.fetchCycles) * 1.0 / total;
+}
+
+inline VOID PrintCacheResults(std::ostream &out, const CacheHierarchy &caches, UINT64 total, const ReportInfo &info)
+{
+    out << "\nCache model (" << info.cachePolicy << ", memory latency " << info.memLatency << ")" << std::endl;
+    out << std::setw(6) << std::left << "Level" << std::setw(10) << "Size KB" << std::setw(6) << "Ways" << std::setw(6) << "Line"
+        << std::setw(9) << "Latency" << std::setw(16) << "Accesses" << std::setw(16) << "Misses" << "Miss rate" << std::endl;
+    for (UINT32 i = 0; i < CACHE_LEVELS; i++)
+    {
+        if (!info.cacheConfigs[i].sizeKB)
+            continue;
+        const Cache &cache = caches.level[i];
+        out << std::setw(6) << std::left << cacheLevelNames[i] << std::setw(10) << info.cacheConfigs[i].sizeKB << std::setw(6) << info.cacheConfigs[i].assoc
+            << std::setw(6) << info.cacheConfigs[i].lineSize << std::setw(9) << info.cacheConfigs[i].latency << std::setw(16) << cache.accesses
+            << std::setw(16) << cache.misses << std::fixed << std::setprecision(2)
+            << (cache.accesses ? 100.0 * cache.misses / cache.accesses : 0.0) << "%" << std::endl;
+    }
+    out << "Data access cycles: " << caches.dataCycles << std::endl;
+    out << "Instruction fetch stall cycles: " << caches.fetchCycles << std::endl;
+    out << "CPI (cache model): " << CacheCpi(caches, total) << std::endl;
+}
+
+// CPI with both models: the cache model CPI plus the penalty of every misprediction
+inline FLT64 ModelCpi(const Metrics *m, UINT64 total, UINT32 branchPenalty)
+{
+    return (total + m->caches.dataCycles + m->caches.fetchCycles + m->branches.Mispredictions() * branchPenalty) * 1.0 / total;
+}
+
+inline VOID PrintBranchResults(std::ostream &out, const Metrics *m, UINT64 total, const ReportInfo &info)
+{
+    const BranchModel &branches = m->branches;
+    out << "\nBranch model (misprediction penalty " << info.branchPenalty << ")" << std::endl;
+    out << std::setw(12) << std::left << "Predictor" << std::setw(16) << "Branches" << std::setw(16) << "Mispredicted"
+        << std::setw(10) << "MPKI" << "Accuracy" << std::endl;
+    for (UINT32 i = 0; i <= info.numBranchPredictors + 1; i++)
+    {
+        const char *name;
+        UINT64 count, misses;
+        if (i < info.numBranchPredictors)
+        {
+            name = branchPredictorNames[info.branchPredictors[i]];
+            count = branches.condBranches;
+            misses = branches.condMisses[i];
+        }
+        else if (i == info.numBranchPredictors)
+        {
+            name = "btb";
+            count = branches.indirectBranches;
+            misses = branches.indirectMisses;
+        }
+        else
+        {
+            name = "ras";
+            count = branches.returns;
+            misses = branches.returnMisses;
+        }
+        out << std::setw(12) << std::left << name << std::setw(16) << count << std::setw(16) << misses << std::fixed
+            << std::setprecision(2) << std::setw(10) << (total ? 1000.0 * misses / total : 0.0)
+            << (count ? 100.0 * (count - misses) / count : 100.0) << "%" << std::endl;
+    }
+    out << "Branch misprediction cycles: " << branches.Mispredictions() * info.branchPenalty << std::endl;
+    out << (info.cacheConfigs ? "CPI (cache and branch model): " : "CPI (branch model): ") << ModelCpi(m, total, info.branchPenalty) << std::endl;
+}
+
+// Coverage is the share of the L1D misses a prefetcher had requested, accuracy
+// the share of its requests that a miss used
+inline VOID PrintPrefetchResults(std::ostream &out, const Metrics *m, const ReportInfo &info)
+{
+    const PrefetchModel &prefetch = m->prefetch;
+    out << "\nPrefetch model (L1D misses " << prefetch.misses << ", degree " << info.prefetchDegree << ")" << std::endl;
+    out << std::setw(12) << std::left << "Prefetcher" << std::setw(16) << "Issued" << std::setw(16) << "Useful"
+        << std::setw(12) << "Accuracy %" << "Coverage %" << std::endl;
+    for (UINT32 i = 0; i < PREFETCHER_KINDS; i++)
+        out << std::setw(12) << std::left << prefetcherNames[i] << std::setw(16) << prefetch.issued[i] << std::setw(16)
+            << prefetch.useful[i] << std::fixed << std::setprecision(2) << std::setw(12)
+            << (prefetch.issued[i] ? 100.0 * prefetch.useful[i] / prefetch.issued[i] : 0.0)
+            << (prefetch.misses ? 100.0 * prefetch.useful[i] / prefetch.misses : 0.0) << std::endl;
+    UINT64 loads = 0;
+    for (UINT32 i = 0; i < STRIDE_CLASSES; i++)
+        loads += prefetch.loads[i];
+    out << std::setw(16) << std::left << "Load stride" << std::setw(16) << "Loads" << std::setw(10) << "Share %" << "Static loads" << std::endl;
+    for (UINT32 i = 0; i < STRIDE_CLASSES; i++)
+        out << std::setw(16) << std::left << strideClassNames[i] << std::setw(16) << prefetch.loads[i] << std::fixed
+            << std::setprecision(2) << std::setw(10) << (loads ? 100.0 * prefetch.loads[i] / loads : 0.0)
+            << prefetch.staticLoads[i] << std::endl;
+    UINT64 blocks = m->prefetchable.Size();
+    out << "Prefetchable 32 bytes region for data " << blocks;
+    if (info.metrics & METRIC_FOOTPRINT)
+        out << " (" << std::fixed << std::setprecision(2) << 100.0 * blocks / std::max(m->dataFootprint.Size(), (UINT64)1)
+            << "% of the footprint)";
+    out << std::endl;
+}
+
+// Per page size the L1 and STLB misses per kilo instruction and the page walk
+// cycles, then what 2MB pages would save over 4KB ones
+inline VOID PrintTlbResults(std::ostream &out, const TlbModel &tlb, UINT64 total, const ReportInfo &info)
+{
+    out << "\nTLB model (page walk " << info.pageWalk << " cycles)" << std::endl;
+    out << std::setw(7) << std::left << "Pages" << std::setw(6) << "TLB" << std::setw(9) << "Entries" << std::setw(6) << "Ways"
+        << std::setw(16) << "Accesses" << std::setw(16) << "Misses" << "MPKI" << std::endl;
+    UINT64 walkCycles[TLB_PAGE_SIZES];
+    for (UINT32 k = 0; k < TLB_PAGE_SIZES; k++)
+    {
+        UINT64 walks = tlb.walks[TLB_DATA][k] + tlb.walks[TLB_INS][k];
+        for (UINT32 level = 0; level < TLB_LEVELS; level++)
+        {
+            const TlbConfig &config = info.tlbConfigs[level];
+            if (!config.entries)
+                continue;
+            UINT64 accesses, misses;
+            if (level == TLB_STLB)
+            {
+                accesses = tlb.misses[TLB_DATA][k] + tlb.misses[TLB_INS][k];
+                misses = walks;
+            }
+            else
+            {
+                UINT32 stream = level == TLB_DTLB ? TLB_DATA : TLB_INS;
+                accesses = tlb.accesses[stream][k];
+                misses = tlb.misses[stream][k];
+            }
+            out << std::setw(7) << std::left << tlbPageNames[k] << std::setw(6) << tlbLevelNames[level] << std::setw(9)
+                << config.entries << std::setw(6) << config.assoc << std::setw(16) << accesses << std::setw(16) << misses
+                << std::fixed << std::setprecision(3) << (total ? 1000.0 * misses / total : 0.0) << std::endl;
+        }
+        walkCycles[k] = walks * info.pageWalk;
+        out << "Page walk cycles (" << tlbPageNames[k] << " pages): " << walkCycles[k] << ", CPI "
+            << (total ? walkCycles[k] * 1.0 / total : 0.0) << std::endl;
+    }
+    UINT64 saved = walkCycles[0] > walkCycles[1] ? walkCycles[0] - walkCycles[1] : 0;
+    out << "Huge pages would save " << saved << " page walk cycles (" << std::setprecision(2)
+        << (walkCycles[0] ? 100.0 * saved / walkCycles[0] : 0.0) << "%), CPI " << std::setprecision(3)
+        << (total ? saved * 1.0 / total : 0.0) << std::endl;
+}
+
+// IPC of the dataflow model, with the critical path (the IPC of an unlimited
+// core) and the average number of L1D missing loads in flight
+inline VOID PrintTimingResults(std::ostream &out, const Metrics *m, const ReportInfo &info)
+{
+    const TimingModel &timing = m->timing;
+    UINT64 cycles = timing.TotalCycles();
+    UINT64 path = timing.TotalCriticalPath();
+    out << "\nTiming model (ROB " << info.robSize << ", width " << info.issueWidth << ")" << std::endl;
+    out << "Instructions: " << timing.instructions << std::endl;
+    out << "Cycles: " << cycles << std::endl;
+    out << "IPC (timing model): " << std::fixed << std::setprecision(3) << (cycles ? timing.instructions * 1.0 / cycles : 0.0) << std::endl;
+    out << "CPI (timing model): " << (timing.instructions ? cycles * 1.0 / timing.instructions : 0.0) << std::endl;
+    out << "Critical path: " << path << " cycles, ILP " << (path ? timing.instructions * 1.0 / path : 0.0) << std::endl;
+    out << "Loads: " << timing.loads << ", average latency " << (timing.loads ? timing.loadCycles * 1.0 / timing.loads : 0.0) << std::endl;
+    out << "MLP: " << (timing.missBusy ? timing.missCycles * 1.0 / timing.missBusy : 0.0) << std::endl;
+}
+
+// Reuse distance histogram with the miss ratio of a fully associative LRU cache
+// holding as many blocks as the upper end of each row, then the working set curve
+inline VOID PrintReuseResults(std::ostream &out, const ReuseProfile &reuse, const ReportInfo &info)
+{
+    // the budget may have lowered the rate below the one asked for
+    FLT64 rate = reuse.rate > 0 ? reuse.rate : info.reuseRate;
+    out << "\nReuse distance of 32 byte data blocks (";
+    if (rate >= 1)
+        out << "exact)" << std::endl;
+    else
+        out << "sampled, rate " << std::fixed << std::setprecision(4) << rate << ")" << std::endl;
+    out << std::setw(24) << std::left << "Distance" << std::setw(16) << "Accesses" << std::setw(16) << "LRU cache KB"
+        << "Miss ratio" << std::endl;
+    UINT32 last = 0;
+    for (UINT32 i = 0; i < REUSE_BUCKETS; i++)
+        if (reuse.bucket[i] > 0)
+            last = i;
+    FLT64 misses = reuse.accesses - reuse.cold;
+    for (UINT32 i = 0; i <= last; i++)
+    {
+        misses -= reuse.bucket[i];
+        std::string range = i <= 1 ? std::to_string(i) : std::to_string((UINT64)1 << (i - 1)) + "-" + std::to_string(((UINT64)1 << i) - 1);
+        out << std::setw(24) << std::left << range << std::setw(16) << std::fixed << std::setprecision(0) << reuse.bucket[i]
+            << std::setw(16) << std::setprecision(2) << (((UINT64)1 << i) * 32) / 1024.0 << std::setprecision(4)
+            << (reuse.accesses > 0 ? (misses + reuse.cold) / reuse.accesses : 0.0) << std::endl;
+    }
+    out << std::setw(24) << std::left << "cold" << std::setprecision(0) << reuse.cold << std::endl;
+
+    out << "Working set, distinct data blocks per " << info.reuseInterval << " block accesses:" << std::endl;
+    for (size_t i = 0; i < reuse.workingSet.size(); i++)
+        out << std::setw(8) << std::left << i << std::setprecision(0) << reuse.workingSet[i] << std::endl;
+    out << std::setprecision(2);
+}
+
+// The extremes start at the INT64 limits, an ia32 report prints the INT32 ones while they are unchanged
+inline INT64 OperandExtreme(INT64 value, const ReportInfo &info)
+{
+    if (info.addressBits == 32 && value == INT64_MIN)
+        return INT32_MIN;
+    if (info.addressBits == 32 && value == INT64_MAX)
+        return INT32_MAX;
+    return value;
+}
+
+inline VOID PrintPartD(std::ostream &out, const Metrics *m, const ReportInfo &info)
+{
+    // Instruction length and frequency
+    out << "\nD1 Distribution of instruction length (All Ins)" << std::endl;
+    PrintHistogram(out, m->insLengthHist, " bytes");
+
+    // operands count and frequency
+    out << "\nD2 Distribution of the number of operands in an instruction (All Ins)" << std::endl;
+    PrintHistogram(out, m->insOperandsHist, " operands");
+
+    // register read operands
+    out << "\nD3 Distribution of the number of register read operands in an instruction (All Ins)" << std::endl;
+    PrintHistogram(out, m->insRegReadHist, " register read operands");
+
+    // register write operands
+    out << "\nD4 Distribution of the number of register write operands in an instruction (All Ins)" << std::endl;
+    PrintHistogram(out, m->insRegWriteHist, " register write operands");
+
+    // memory operands
+    UINT64 memins = 0;
+    out << "\nD5 Distribution of the number of memory operands in an instruction (Predicated Ins)" << std::endl;
+    PrintHistogram(out, m->insMemOperandsHist, " memory operands");
+    for (UINT32 i = 1; i <= HIST_BUCKETS; i++)
+        memins += m->insMemOperandsHist.bucket[i];
+
+    // memory read operands
+    out << "\nD6 Distribution of the number of memory read operands in an instruction (Predicated Ins)" << std::endl;
+    PrintHistogram(out, m->insMemReadHist, " memory read operands");
+
+    // memory write operands
+    out << "\nD7 Distribution of the number of memory write operands in an instruction (Predicated Ins)" << std::endl;
+    PrintHistogram(out, m->insMemWriteHist, " memory write operands");
+
+    // memory touched
+    out << "\nD8 Maximum and average number of memory bytes touched by any memory instruction (Predicated Ins)" << std::endl;
+    out << "Maximum number of memory bytes touched: " << m->insMemTouchedMax << std::endl;
+    out << "Average number of memory bytes touched: " << m->insMemTouched * 1.0 / memins << std::endl;
+
+    out << "\nD9 Maximum and minimum values of the immediate field in an instruction." << std::endl;
+    out << "Maximum value of the immediate field: " << OperandExtreme(m->immediateMax, info) << std::endl;
+    out << "Minimum value of the immediate field: " << OperandExtreme(m->immediateMin, info) << std::endl;
+
+    out << "\nD10 Maximum and minimum values of the displacement field in a memory instruction(Predicated Ins)" << std::endl;
+    out << "Maximum value of the displacement field: " << OperandExtreme(m->displacementMax, info) << std::endl;
+    out << "Minimum value of the displacement field: " << OperandExtreme(m->displacementMin, info) << std::endl;
+}
+
+inline VOID PrintResults(std::ostream &out, const Metrics *m, const ReportInfo &info)
+{
+    UINT64 total = InstMetricsTotal(m->instMetrics);
+
+    out << "===============================================" << std::endl;
+    out << "HW1 analysis results from " << info.outputFile << std::endl;
+    out << "Number of instructions: " << info.insCount << std::endl;
+    out << "Fast forward at:        " << info.windowStart << std::endl;
+    out << "Number of instructions after fast forward: " << info.insCount - info.windowStart << std::endl;
+    if (info.numWindows > 1)
+        out << "Window:                 " << info.windowIndex + 1 << " of " << info.numWindows << std::endl;
+    out << "\n=====================PARTA=====================" << std::endl;
+    if (!(info.metrics & METRIC_MIX))
+        out << "Not measured, see -metrics" << std::endl;
+    else
+    {
+        out << std::setw(35) << std::left << "Number of loads:" << PRINT_METRICS(m->instMetrics.numLoads, total);
+        out << std::setw(35) << std::left << "Number of stores:" << PRINT_METRICS(m->instMetrics.numStores, total);
+        out << std::setw(35) << std::left << "Number of nops:" << PRINT_METRICS(m->instMetrics.numNops, total);
+        out << std::setw(35) << std::left << "Number of direct calls:" << PRINT_METRICS(m->instMetrics.numDirectCalls, total);
+        out << std::setw(35) << std::left << "Number of indirect calls:" << PRINT_METRICS(m->instMetrics.numIndirectCalls, total);
+        out << std::setw(35) << std::left << "Number of returns:" << PRINT_METRICS(m->instMetrics.numReturns, total);
+        out << std::setw(35) << std::left << "Number of unconditional branches:" << PRINT_METRICS(m->instMetrics.numUncondBranches, total);
+        out << std::setw(35) << std::left << "Number of conditional branches:" << PRINT_METRICS(m->instMetrics.numCondBranches, total);
+        out << std::setw(35) << std::left << "Number of logical operations:" << PRINT_METRICS(m->instMetrics.numLogicalOps, total);
+        out << std::setw(35) << std::left << "Number of rotate/shift operations:" << PRINT_METRICS(m->instMetrics.numRotateShift, total);
+        out << std::setw(35) << std::left << "Number of flag operations:" << PRINT_METRICS(m->instMetrics.numFlagOps, total);
+        out << std::setw(35) << std::left << "Number of vector operations:" << PRINT_METRICS(m->instMetrics.numVector, total);
+        out << std::setw(35) << std::left << "Number of conditional moves:" << PRINT_METRICS(m->instMetrics.numCondMoves, total);
+        out << std::setw(35) << std::left << "Number of MMX/SSE operations:" << PRINT_METRICS(m->instMetrics.numMMXSSE, total);
+        out << std::setw(35) << std::left << "Number of system calls:" << PRINT_METRICS(m->instMetrics.numSysCalls, total);
+        out << std::setw(35) << std::left << "Number of FP operations:" << PRINT_METRICS(m->instMetrics.numFP, total);
+        out << std::setw(35) << std::left << "Number of other instructions:" << PRINT_METRICS(m->instMetrics.numRest, total);
+    }
+    out << "\n=====================PARTB=====================" << std::endl;
+    FLT64 cpi = FlatCpi(m->instMetrics, total);
+    if (info.metrics & METRIC_MIX)
+        out << "CPI: " << cpi << std::endl;
+    if (info.cacheConfigs)
+        PrintCacheResults(out, m->caches, total, info);
+    if (info.branchPredictors)
+        PrintBranchResults(out, m, total, info);
+    if (info.tlbConfigs)
+        PrintTlbResults(out, m->tlb, total, info);
+    if (info.prefetchDegree)
+        PrintPrefetchResults(out, m, info);
+    if (info.robSize)
+        PrintTimingResults(out, m, info);
+    out << "\n=====================PARTC=====================" << std::endl;
+    if (info.metrics & METRIC_FOOTPRINT)
+    {
+        // Instruction footprint
+        UINT64 dataBlocks = m->dataFootprint.Size();
+        UINT64 insBlocks = m->insFootprint.Size();
+        out << "Number of 32 bytes region for data " << dataBlocks << std::endl;
+        out << "Size of region is " << dataBlocks * 32 << " bytes" << std::endl;
+        out << "Number of 32 bytes region for instructions " << insBlocks << std::endl;
+        out << "Size of region is " << insBlocks * 32 << " bytes " << std::endl;
+        if (m->dataFootprint.Estimated() || m->insFootprint.Estimated())
+            out << "Footprint estimated past the memory budget, standard error " << std::fixed << std::setprecision(2)
+                << 100.0 * std::max(m->dataFootprint.StandardError(), m->insFootprint.StandardError()) << "%" << std::endl;
+        if (info.tlbConfigs)
+            for (UINT32 k = 0; k < TLB_PAGE_SIZES; k++)
+            {
+                out << "Number of " << tlbPageNames[k] << " pages for data " << m->tlb.pages[TLB_DATA][k].Size() << std::endl;
+                out << "Number of " << tlbPageNames[k] << " pages for instructions " << m->tlb.pages[TLB_INS][k].Size() << std::endl;
+            }
+        if (info.reuseRate > 0)
+            PrintReuseResults(out, m->reuse, info);
+    }
+    else
+        out << "Not measured, see -metrics" << std::endl;
+    out << "\n=====================PARTD=====================" << std::endl;
+    if (info.metrics & METRIC_PARTD)
+        PrintPartD(out, m, info);
+    else
+        out << "Not measured, see -metrics" << std::endl;
+    out << "===============================================" << std::endl;
+
+    out << "\nFor General max-min:" << std::endl;
+    out << "INT32_MAX = " << INT32_MAX << std::endl;
+    out << "INT32_MIN = " << INT32_MIN << std::endl;
+    if (info.addressBits != 32)
+    {
+        out << "INT64_MAX = " << INT64_MAX << std::endl;
+        out << "INT64_MIN = " << INT64_MIN << std::endl;
+    }
+
+    std::chrono::time_point<std::chrono::system_clock> endTime = std::chrono::system_clock::now();
+    std::chrono::duration<double> elapsed_seconds = endTime - info.startTime;
+    out << "\nTime elapsed: " << elapsed_seconds.count() / 60 << " minutes" << std::endl;
+}
+
+#endif
@@ -0,0 +1,310 @@
+/*
+ * HW1Dump: print binary HW1 result files (written with -ob) as CSV or JSON.
+ *
+ * Usage: HW1Dump [-json] [-t table] file...
+ *
+ * CSV prints one table (default "windows"). With several files a leading
+ * "file" column is added, so the results of many runs end up in one table.
+ * JSON prints every table unless -t is given.
+ */
+
+#include "HW1Result.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+using std::vector;
+
+typedef struct _Table
+{
+    const HW1TableHeader *header;
+    const HW1ColumnHeader *columns;
+} Table;
+
+typedef struct _ResultFile
+{
+    string name;
+    const char *data;
+    UINT64 size;
+    vector<Table> tables;
+} ResultFile;
+
+static BOOL Fail(const string &fileName, const char *message)
+{
+    fprintf(stderr, "HW1Dump: %s: %s\n", fileName.c_str(), message);
+    return FALSE;
+}
+
+// Check that every header and column lies inside the mapped file, returns what is wrong or 0.
+// The sizes come from the file, so the checks divide rather than multiply.
+static const char *CheckResult(ResultFile &result)
+{
+    const HW1FileHeader *fileHeader = (const HW1FileHeader *)result.data;
+    if (memcmp(fileHeader->magic, HW1_RESULT_MAGIC, 4) != 0)
+        return "not a HW1 result file";
+    if (fileHeader->version != HW1_RESULT_VERSION)
+        return "unsupported version";
+
+    UINT64 pos = sizeof(HW1FileHeader);
+    for (UINT32 t = 0; t < fileHeader->numTables; t++)
+    {
+        if (result.size - pos < sizeof(HW1TableHeader))
+            return "truncated table header";
+        Table table;
+        table.header = (const HW1TableHeader *)(result.data + pos);
+        pos += sizeof(HW1TableHeader);
+        if (table.header->numColumns > (result.size - pos) / sizeof(HW1ColumnHeader))
+            return "truncated column header";
+        table.columns = (const HW1ColumnHeader *)(result.data + pos);
+        pos += (UINT64)table.header->numColumns * sizeof(HW1ColumnHeader);
+        for (UINT32 c = 0; c < table.header->numColumns; c++)
+        {
+            const HW1ColumnHeader &column = table.columns[c];
+            if (column.offset > result.size ||
+                (column.width && table.header->numRows > (result.size - column.offset) / sizeof(UINT64) / column.width))
+                return "truncated column data";
+        }
+        result.tables.push_back(table);
+    }
+    return 0;
+}
+
+// Map the file and check it
+static BOOL OpenResult(const string &fileName, ResultFile &result)
+{
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return Fail(fileName, "cannot open");
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (UINT64)st.st_size < sizeof(HW1FileHeader))
+    {
+        close(fd);
+        return Fail(fileName, "too small");
+    }
+    void *data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return Fail(fileName, "cannot map");
+
+    result.name = fileName;
+    result.data = (const char *)data;
+    result.size = st.st_size;
+
+    const char *error = CheckResult(result);
+    if (error)
+    {
+        munmap(data, result.size);
+        return Fail(fileName, error);
+    }
+    return TRUE;
+}
+
+static const Table *FindTable(const ResultFile &result, const string &name)
+{
+    for (size_t t = 0; t < result.tables.size(); t++)
+        if (strncmp(result.tables[t].header->name, name.c_str(), sizeof(result.tables[t].header->name)) == 0)
+            return &result.tables[t];
+    return 0;
+}
+
+static VOID PrintValue(const ResultFile &result, const HW1ColumnHeader &column, UINT64 index)
+{
+    UINT64 bits;
+    memcpy(&bits, result.data + column.offset + index * sizeof(UINT64), sizeof(bits));
+    if (column.type == HW1_COLUMN_I64)
+        printf("%lld", (long long)(INT64)bits);
+    else if (column.type == HW1_COLUMN_F64)
+    {
+        FLT64 value;
+        memcpy(&value, &bits, sizeof(value));
+        printf("%.10g", value);
+    }
+    else
+        printf("%llu", (unsigned long long)bits);
+}
+
+static VOID PrintCsvHeader(const Table &table, BOOL withFile)
+{
+    const char *separator = "";
+    if (withFile)
+    {
+        printf("file");
+        separator = ",";
+    }
+    for (UINT32 c = 0; c < table.header->numColumns; c++)
+    {
+        const HW1ColumnHeader &column = table.columns[c];
+        if (column.width == 1)
+        {
+            printf("%s%.32s", separator, column.name);
+            separator = ",";
+            continue;
+        }
+        for (UINT32 i = 0; i < column.width; i++)
+        {
+            printf("%s%.32s_%u", separator, column.name, i);
+            separator = ",";
+        }
+    }
+    printf("\n");
+}
+
+static VOID PrintCsvRows(const ResultFile &result, const Table &table, BOOL withFile)
+{
+    for (UINT64 r = 0; r < table.header->numRows; r++)
+    {
+        const char *separator = "";
+        if (withFile)
+        {
+            printf("%s", result.name.c_str());
+            separator = ",";
+        }
+        for (UINT32 c = 0; c < table.header->numColumns; c++)
+        {
+            const HW1ColumnHeader &column = table.columns[c];
+            for (UINT32 i = 0; i < column.width; i++)
+            {
+                printf("%s", separator);
+                PrintValue(result, column, r * column.width + i);
+                separator = ",";
+            }
+        }
+        printf("\n");
+    }
+}
+
+// Quoted JSON string of at most maxLength characters, names in the file need not end in a 0
+static VOID PrintJsonString(const char *text, size_t maxLength)
+{
+    printf("\"");
+    for (size_t i = 0; i < maxLength && text[i]; i++)
+    {
+        unsigned char c = text[i];
+        if (c == '"' || c == '\\')
+            printf("\\%c", c);
+        else if (c < 0x20)
+            printf("\\u%04x", c);
+        else
+            putchar(c);
+    }
+    printf("\"");
+}
+
+static VOID PrintJsonTable(const ResultFile &result, const Table &table)
+{
+    printf("    ");
+    PrintJsonString(table.header->name, sizeof(table.header->name));
+    printf(": [");
+    for (UINT64 r = 0; r < table.header->numRows; r++)
+    {
+        printf("%s\n      {", r ? "," : "");
+        for (UINT32 c = 0; c < table.header->numColumns; c++)
+        {
+            const HW1ColumnHeader &column = table.columns[c];
+            printf("%s", c ? ", " : "");
+            PrintJsonString(column.name, sizeof(column.name));
+            printf(": ");
+            if (column.width > 1)
+                printf("[");
+            for (UINT32 i = 0; i < column.width; i++)
+            {
+                if (i)
+                    printf(", ");
+                PrintValue(result, column, r * column.width + i);
+            }
+            if (column.width > 1)
+                printf("]");
+        }
+        printf("}");
+    }
+    printf("\n    ]");
+}
+
+static int Usage()
+{
+    fprintf(stderr, "Usage: HW1Dump [-json] [-t table] file...\n");
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    BOOL json = FALSE;
+    string tableName;
+    vector<string> fileNames;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "-json")
+            json = TRUE;
+        else if (arg == "-csv")
+            json = FALSE;
+        else if (arg == "-t" && i + 1 < argc)
+            tableName = argv[++i];
+        else if (!arg.empty() && arg[0] == '-')
+            return Usage();
+        else
+            fileNames.push_back(arg);
+    }
+    if (fileNames.empty())
+        return Usage();
+    if (!json && tableName.empty())
+        tableName = "windows";
+
+    int status = 0;
+    BOOL withFile = fileNames.size() > 1;
+    BOOL headerPrinted = FALSE;
+    if (json)
+        printf("{");
+    for (size_t f = 0; f < fileNames.size(); f++)
+    {
+        ResultFile result;
+        if (!OpenResult(fileNames[f], result))
+        {
+            status = 1;
+            continue;
+        }
+
+        if (json)
+        {
+            printf("%s\n  ", headerPrinted ? "," : "");
+            PrintJsonString(result.name.c_str(), result.name.size());
+            printf(": {");
+            headerPrinted = TRUE;
+            BOOL first = TRUE;
+            for (size_t t = 0; t < result.tables.size(); t++)
+            {
+                const Table &table = result.tables[t];
+                if (!tableName.empty() && &table != FindTable(result, tableName))
+                    continue;
+                printf("%s\n", first ? "" : ",");
+                PrintJsonTable(result, table);
+                first = FALSE;
+            }
+            printf("\n  }");
+        }
+        else
+        {
+            const Table *table = FindTable(result, tableName);
+            if (table == 0)
+            {
+                Fail(result.name, "no such table");
+                status = 1;
+            }
+            else
+            {
+                if (!headerPrinted)
+                    PrintCsvHeader(*table, withFile);
+                headerPrinted = TRUE;
+                PrintCsvRows(result, *table, withFile);
+            }
+        }
+        munmap((void *)result.data, result.size);
+    }
+    if (json)
+        printf("\n}\n");
+    return status;
+}
@@ -0,0 +1,406 @@
+/*
+ * Sets of touched blocks for the PART C footprint, bounded in memory so
+ * intel64 processes with large heaps can be profiled.
+ *
+ * FootprintBitmap is exact: a sparse radix tree over the block numbers of a
+ * FOOTPRINT_ADDRESS_BITS address space, interior nodes of 256 children and
+ * leaves of 2048 blocks (256 bytes) allocated on first touch. ia32 needs two
+ * levels and intel64 four; the last leaf is remembered, so the walk only runs
+ * when the accesses leave it. Blocks past the address space, from an access
+ * wrapping around it, go to a hash set.
+ *
+ * FootprintSketch is a HyperLogLog estimate of the distinct blocks in 2^bits
+ * one byte registers, with a standard error of 1.04 / sqrt(2^bits).
+ *
+ * Footprint counts exactly until its bitmap outgrows a budget, then folds the
+ * bitmap into a sketch and estimates from there on.
+ */
+
+#ifndef HW1_FOOTPRINT_H
+#define HW1_FOOTPRINT_H
+
+#include "HW1Types.h"
+#include <unordered_set>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#if defined(TARGET_IA32)
+#define FOOTPRINT_ADDRESS_BITS 32
+#else
+#define FOOTPRINT_ADDRESS_BITS 48 // user space with 4 level page tables
+#endif
+#define FOOTPRINT_LEAF_BITS 11
+#define FOOTPRINT_LEAF_WORDS ((1 << FOOTPRINT_LEAF_BITS) / 64)
+#define FOOTPRINT_NODE_BITS 8
+#define FOOTPRINT_NODE_SIZE (1 << FOOTPRINT_NODE_BITS)
+// blocks are 32 bytes, the levels cover the leaf numbers
+#define FOOTPRINT_LEAF_INDEX_BITS (FOOTPRINT_ADDRESS_BITS - 5 - FOOTPRINT_LEAF_BITS)
+#define FOOTPRINT_LEVELS ((FOOTPRINT_LEAF_INDEX_BITS + FOOTPRINT_NODE_BITS - 1) / FOOTPRINT_NODE_BITS)
+
+#define FOOTPRINT_MIN_SKETCH_BITS 4
+#define FOOTPRINT_MAX_SKETCH_BITS 20
+
+class FootprintBitmap
+{
+  public:
+    FootprintBitmap() : lastBlock(~(UINT64)0), lastLeafIndex(~(UINT64)0), lastLeaf(0), count(0), bytes(0), root() {}
+    FootprintBitmap(const FootprintBitmap &) = delete;
+    FootprintBitmap &operator=(const FootprintBitmap &) = delete;
+
+    ~FootprintBitmap()
+    {
+        Clear();
+    }
+
+    VOID Clear()
+    {
+        FreeNode(&root, FOOTPRINT_LEVELS);
+        memset(&root, 0, sizeof(root));
+        overflow.clear();
+        lastBlock = lastLeafIndex = ~(UINT64)0;
+        lastLeaf = 0;
+        count = 0;
+        bytes = 0;
+    }
+
+    // Returns TRUE the first time the block is touched
+    inline BOOL Insert(UINT64 block)
+    {
+        // consecutive accesses mostly hit the same block, then the same leaf
+        if (block == lastBlock)
+            return FALSE;
+        lastBlock = block;
+
+        UINT64 leafIndex = block >> FOOTPRINT_LEAF_BITS;
+        if (leafIndex != lastLeafIndex)
+        {
+            if (leafIndex >> FOOTPRINT_LEAF_INDEX_BITS)
+                return overflow.insert(block).second;
+            lastLeaf = Leaf(leafIndex);
+            lastLeafIndex = leafIndex;
+        }
+        UINT64 &word = lastLeaf[(block >> 6) & (FOOTPRINT_LEAF_WORDS - 1)];
+        UINT64 bit = (UINT64)1 << (block & 63);
+        if (word & bit)
+            return FALSE;
+        word |= bit;
+        count++;
+        return TRUE;
+    }
+
+    VOID Merge(const FootprintBitmap &other)
+    {
+        MergeNode(&root, &other.root, FOOTPRINT_LEVELS);
+        overflow.insert(other.overflow.begin(), other.overflow.end());
+    }
+
+    inline UINT64 Size() const
+    {
+        return count + overflow.size();
+    }
+
+    // Bytes of the tree, the hash set counted at two words per block
+    inline UINT64 Memory() const
+    {
+        return bytes + overflow.size() * 2 * sizeof(UINT64);
+    }
+
+    // Calls f(block) for every block of the set
+    template <class F>
+    VOID ForEach(F &f) const
+    {
+        ForEachNode(&root, FOOTPRINT_LEVELS, 0, f);
+        for (auto it = overflow.begin(); it != overflow.end(); it++)
+            f(*it);
+    }
+
+  private:
+    typedef struct _FootprintNode
+    {
+        VOID *child[FOOTPRINT_NODE_SIZE]; // nodes one level down, leaves below level 1
+    } FootprintNode;
+
+    UINT64 lastBlock;
+    UINT64 lastLeafIndex;
+    UINT64 *lastLeaf;
+    UINT64 count; // blocks in the leaves
+    UINT64 bytes; // of the nodes and leaves below the root
+    FootprintNode root;
+    std::unordered_set<UINT64> overflow;
+
+    inline VOID *Allocate(size_t size)
+    {
+        bytes += size;
+        return calloc(1, size);
+    }
+
+    UINT64 *Leaf(UINT64 leafIndex)
+    {
+        FootprintNode *node = &root;
+        for (UINT32 level = FOOTPRINT_LEVELS - 1; level > 0; level--)
+        {
+            VOID *&child = node->child[(leafIndex >> (level * FOOTPRINT_NODE_BITS)) & (FOOTPRINT_NODE_SIZE - 1)];
+            if (child == 0)
+                child = Allocate(sizeof(FootprintNode));
+            node = (FootprintNode *)child;
+        }
+        VOID *&leaf = node->child[leafIndex & (FOOTPRINT_NODE_SIZE - 1)];
+        if (leaf == 0)
+            leaf = Allocate(FOOTPRINT_LEAF_WORDS * sizeof(UINT64));
+        return (UINT64 *)leaf;
+    }
+
+    static VOID FreeNode(FootprintNode *node, UINT32 level)
+    {
+        for (UINT32 i = 0; i < FOOTPRINT_NODE_SIZE; i++)
+        {
+            if (node->child[i] == 0)
+                continue;
+            if (level > 1)
+                FreeNode((FootprintNode *)node->child[i], level - 1);
+            free(node->child[i]);
+        }
+    }
+
+    VOID MergeNode(FootprintNode *node, const FootprintNode *other, UINT32 level)
+    {
+        for (UINT32 i = 0; i < FOOTPRINT_NODE_SIZE; i++)
+        {
+            if (other->child[i] == 0)
+                continue;
+            if (level > 1)
+            {
+                if (node->child[i] == 0)
+                    node->child[i] = Allocate(sizeof(FootprintNode));
+                MergeNode((FootprintNode *)node->child[i], (const FootprintNode *)other->child[i], level - 1);
+                continue;
+            }
+            if (node->child[i] == 0)
+                node->child[i] = Allocate(FOOTPRINT_LEAF_WORDS * sizeof(UINT64));
+            UINT64 *leaf = (UINT64 *)node->child[i];
+            const UINT64 *otherLeaf = (const UINT64 *)other->child[i];
+            for (UINT32 w = 0; w < FOOTPRINT_LEAF_WORDS; w++)
+            {
+                count += __builtin_popcountll(otherLeaf[w] & ~leaf[w]);
+                leaf[w] |= otherLeaf[w];
+            }
+        }
+    }
+
+    template <class F>
+    static VOID ForEachNode(const FootprintNode *node, UINT32 level, UINT64 prefix, F &f)
+    {
+        for (UINT32 i = 0; i < FOOTPRINT_NODE_SIZE; i++)
+        {
+            if (node->child[i] == 0)
+                continue;
+            UINT64 index = (prefix << FOOTPRINT_NODE_BITS) | i;
+            if (level > 1)
+            {
+                ForEachNode((const FootprintNode *)node->child[i], level - 1, index, f);
+                continue;
+            }
+            const UINT64 *leaf = (const UINT64 *)node->child[i];
+            for (UINT32 w = 0; w < FOOTPRINT_LEAF_WORDS; w++)
+                for (UINT64 word = leaf[w]; word; word &= word - 1)
+                    f((index << FOOTPRINT_LEAF_BITS) | (w * 64 + __builtin_ctzll(word)));
+        }
+    }
+};
+
+class FootprintSketch
+{
+  public:
+    FootprintSketch() : bits(0), lastBlock(~(UINT64)0), registers(0) {}
+    FootprintSketch(const FootprintSketch &) = delete;
+    FootprintSketch &operator=(const FootprintSketch &) = delete;
+
+    ~FootprintSketch()
+    {
+        free(registers);
+    }
+
+    VOID Init(UINT32 registerBits)
+    {
+        bits = registerBits;
+        registers = (UINT8 *)calloc((size_t)1 << bits, 1);
+    }
+
+    inline BOOL Enabled() const
+    {
+        return registers != 0;
+    }
+
+    inline UINT32 Bits() const
+    {
+        return bits;
+    }
+
+    inline VOID Insert(UINT64 block)
+    {
+        if (block == lastBlock)
+            return;
+        lastBlock = block;
+        UINT64 hash = Hash(block);
+        // the top bits pick the register, the leading zeros of the rest are its rank
+        UINT64 rest = (hash << bits) | ((UINT64)1 << (bits - 1));
+        UINT8 rank = __builtin_clzll(rest) + 1;
+        UINT8 &reg = registers[hash >> (64 - bits)];
+        if (rank > reg)
+            reg = rank;
+    }
+
+    VOID Clear()
+    {
+        if (registers)
+            memset(registers, 0, (size_t)1 << bits);
+        lastBlock = ~(UINT64)0;
+    }
+
+    VOID Merge(const FootprintSketch &other)
+    {
+        for (UINT64 i = 0; i < ((UINT64)1 << bits); i++)
+            if (other.registers[i] > registers[i])
+                registers[i] = other.registers[i];
+    }
+
+    // Raw HyperLogLog estimate, linear counting while registers are still empty
+    UINT64 Size() const
+    {
+        FLT64 m = (FLT64)((UINT64)1 << bits);
+        FLT64 sum = 0;
+        UINT64 zeros = 0;
+        for (UINT64 i = 0; i < ((UINT64)1 << bits); i++)
+        {
+            sum += ldexp(1.0, -registers[i]);
+            zeros += registers[i] == 0;
+        }
+        FLT64 estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+        if (estimate <= 2.5 * m && zeros)
+            estimate = m * log(m / zeros);
+        return (UINT64)(estimate + 0.5);
+    }
+
+    inline FLT64 StandardError() const
+    {
+        return 1.04 / sqrt((FLT64)((UINT64)1 << bits));
+    }
+
+  private:
+    UINT32 bits;
+    UINT64 lastBlock;
+    UINT8 *registers;
+
+    static inline UINT64 Hash(UINT64 block)
+    {
+        UINT64 x = block + 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+};
+
+class Footprint
+{
+  public:
+    Footprint() : budget(0), sketchBits(14), estimated(FALSE) {}
+    Footprint(const Footprint &) = delete;
+    Footprint &operator=(const Footprint &) = delete;
+
+    // budgetBytes of bitmap before switching to a sketch of 2^registerBits registers, 0 for always exact
+    VOID Init(UINT64 budgetBytes, UINT32 registerBits)
+    {
+        budget = budgetBytes;
+        sketchBits = registerBits;
+    }
+
+    // Returns TRUE the first time the block is touched, always FALSE once estimated
+    inline BOOL Insert(UINT64 block)
+    {
+        if (estimated)
+        {
+            sketch.Insert(block);
+            return FALSE;
+        }
+        if (!bitmap.Insert(block))
+            return FALSE;
+        if (budget && bitmap.Memory() > budget)
+            Spill();
+        return TRUE;
+    }
+
+    // A new window counts exactly again
+    VOID Clear()
+    {
+        bitmap.Clear();
+        sketch.Clear();
+        estimated = FALSE;
+    }
+
+    VOID Merge(const Footprint &other)
+    {
+        if (other.estimated && !estimated)
+        {
+            sketchBits = other.sketch.Bits();
+            Spill();
+        }
+        if (!estimated)
+        {
+            bitmap.Merge(other.bitmap);
+            if (budget && bitmap.Memory() > budget)
+                Spill();
+        }
+        else if (other.estimated)
+            sketch.Merge(other.sketch);
+        else
+        {
+            SketchInsert insert = {&sketch};
+            other.bitmap.ForEach(insert);
+        }
+    }
+
+    inline UINT64 Size() const
+    {
+        return estimated ? sketch.Size() : bitmap.Size();
+    }
+
+    inline BOOL Estimated() const
+    {
+        return estimated;
+    }
+
+    inline FLT64 StandardError() const
+    {
+        return estimated ? sketch.StandardError() : 0;
+    }
+
+  private:
+    struct SketchInsert
+    {
+        FootprintSketch *sketch;
+        inline VOID operator()(UINT64 block)
+        {
+            sketch->Insert(block);
+        }
+    };
+
+    UINT64 budget;
+    UINT32 sketchBits;
+    BOOL estimated;
+    FootprintBitmap bitmap;
+    FootprintSketch sketch;
+
+    // Fold the exact blocks into the sketch and free the bitmap
+    VOID Spill()
+    {
+        if (!sketch.Enabled())
+            sketch.Init(sketchBits);
+        SketchInsert insert = {&sketch};
+        bitmap.ForEach(insert);
+        bitmap.Clear();
+        estimated = TRUE;
+    }
+};
+
+#endif
@@ -0,0 +1,351 @@
+/*
+ * Code layout advice behind -layout, from the edge profile of the basic blocks.
+ *
+ * Routines are ordered Pettis-Hansen style: the call edges, heaviest first,
+ * join the chains of the caller and the callee, each turned so the two
+ * routines end up as close as possible, and the chains are placed by
+ * instructions executed per byte, hottest first. Within a routine the blocks
+ * are chained the same way along their heaviest edges so the hot path falls
+ * through, and the bytes no block executed are the cold part a hot/cold split
+ * would move out of the way.
+ *
+ * The executed code is measured in 32 byte regions, cache lines and 4KB pages
+ * as it is laid out now, with the routines reordered, and with the routines
+ * reordered and split so only their executed bytes stay, packed together.
+ * Code outside any routine is left out, it cannot be moved.
+ */
+
+#ifndef HW1_LAYOUT_H
+#define HW1_LAYOUT_H
+
+#include "HW1Types.h"
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#define LAYOUT_ALIGN 16 // routine alignment of the new layout
+#define LAYOUT_NONE (~(UINT32)0)
+
+// How a block ends
+enum
+{
+    LAYOUT_FALL = 0, // into fallThrough, the next block
+    LAYOUT_COND = 1, // conditional direct branch to target
+    LAYOUT_JUMP = 2, // direct jump to target
+    LAYOUT_CALL = 3, // direct call to target, returning to fallThrough
+    LAYOUT_OTHER = 4 // indirect branch, call or return
+};
+
+// One basic block record with its executions over all windows
+typedef struct _LayoutBlock
+{
+    UINT64 address;
+    UINT32 size;
+    UINT32 numIns;
+    UINT32 routine; // 0 outside any routine
+    UINT32 kind;
+    UINT64 target;
+    UINT64 fallThrough;
+    UINT64 executions;
+    UINT64 taken; // LAYOUT_COND only
+} LayoutBlock;
+
+typedef struct _LayoutRoutine
+{
+    UINT64 address;
+    UINT64 size;
+    UINT64 instructions; // executed
+    UINT64 hotBytes;     // covered by executed blocks
+    UINT64 coldBytes;
+} LayoutRoutine;
+
+typedef struct _LayoutFootprint
+{
+    UINT64 regions; // 32 bytes
+    UINT64 lines;
+    UINT64 pages; // 4KB
+} LayoutFootprint;
+
+class CodeLayout
+{
+  public:
+    std::vector<LayoutRoutine> routines;
+    std::vector<UINT32> order; // executed routines, in their new order
+    LayoutFootprint before;
+    LayoutFootprint ordered;
+    LayoutFootprint split;
+    UINT64 instructions; // in routines
+    UINT64 callEdges;
+    UINT64 blockEdges;
+    UINT64 takenBefore; // branch executions inside routines that do not fall through
+    UINT64 takenAfter;  // same with the blocks chained
+
+    CodeLayout() : instructions(0), callEdges(0), blockEdges(0), takenBefore(0), takenAfter(0)
+    {
+        before = ordered = split = LayoutFootprint();
+    }
+
+    // routineRanges: address and size of every routine id, lineBits: log2 of the cache line
+    VOID Build(const std::vector<LayoutBlock> &blocks, const std::vector<LayoutRoutine> &routineRanges, UINT32 lineBits)
+    {
+        routines = routineRanges;
+        for (UINT32 r = 1; r < routines.size(); r++)
+            routineStarts[routines[r].address] = r;
+        std::map<UINT64, UINT32> starts; // block starting at an address, the most executed one
+        for (UINT32 b = 0; b < blocks.size(); b++)
+        {
+            const LayoutBlock &block = blocks[b];
+            if (block.executions == 0 || block.routine == 0 || block.routine >= routines.size())
+                continue;
+            auto it = starts.find(block.address);
+            if (it == starts.end() || blocks[it->second].executions < block.executions)
+                starts[block.address] = b;
+            routines[block.routine].instructions += block.executions * block.numIns;
+            instructions += block.executions * block.numIns;
+        }
+
+        std::vector<Edge> edges;
+        std::map<std::pair<UINT32, UINT32>, UINT64> calls;
+        for (auto it = starts.begin(); it != starts.end(); it++)
+        {
+            UINT32 b = it->second;
+            const LayoutBlock &block = blocks[b];
+            UINT64 taken = std::min(block.taken, block.executions);
+            switch (block.kind)
+            {
+            case LAYOUT_COND:
+                AddEdge(edges, blocks, starts, b, block.target, taken);
+                AddEdge(edges, blocks, starts, b, block.fallThrough, block.executions - taken);
+                break;
+            case LAYOUT_JUMP:
+                AddEdge(edges, blocks, starts, b, block.target, block.executions);
+                break;
+            case LAYOUT_FALL:
+                AddEdge(edges, blocks, starts, b, block.fallThrough, block.executions);
+                break;
+            case LAYOUT_CALL:
+            {
+                UINT32 callee = RoutineAt(block.target);
+                if (callee && callee != block.routine)
+                    calls[std::make_pair(std::min(callee, block.routine), std::max(callee, block.routine))] += block.executions;
+                AddEdge(edges, blocks, starts, b, block.fallThrough, block.executions);
+                break;
+            }
+            default:
+                break;
+            }
+        }
+        callEdges = calls.size();
+        blockEdges = edges.size();
+
+        ChainBlocks(edges, blocks);
+        OrderRoutines(calls);
+        Measure(blocks, lineBits);
+    }
+
+  private:
+    std::map<UINT64, UINT32> routineStarts;
+
+    typedef struct _Edge
+    {
+        UINT32 from;
+        UINT32 to;
+        UINT64 weight;
+    } Edge;
+
+    static BOOL Heavier(const Edge &a, const Edge &b)
+    {
+        return a.weight > b.weight || (a.weight == b.weight && (a.from < b.from || (a.from == b.from && a.to < b.to)));
+    }
+
+    // Routine starting at address, 0 if none
+    UINT32 RoutineAt(UINT64 address) const
+    {
+        auto it = routineStarts.find(address);
+        return it == routineStarts.end() ? 0 : it->second;
+    }
+
+    // Edge inside the routine of from, to blocks that executed
+    static VOID AddEdge(std::vector<Edge> &edges, const std::vector<LayoutBlock> &blocks, const std::map<UINT64, UINT32> &starts,
+                        UINT32 from, UINT64 to, UINT64 weight)
+    {
+        auto it = starts.find(to);
+        if (weight == 0 || it == starts.end() || blocks[it->second].routine != blocks[from].routine)
+            return;
+        Edge edge = {from, it->second, weight};
+        edges.push_back(edge);
+    }
+
+    static UINT32 Find(std::vector<UINT32> &parent, UINT32 x)
+    {
+        while (parent[x] != x)
+            x = parent[x] = parent[parent[x]];
+        return x;
+    }
+
+    // Greedy bottom-up block positioning, counts the branches left taken
+    VOID ChainBlocks(std::vector<Edge> &edges, const std::vector<LayoutBlock> &blocks)
+    {
+        std::vector<UINT32> next(blocks.size(), LAYOUT_NONE), prev(blocks.size(), LAYOUT_NONE), chain(blocks.size());
+        for (UINT32 b = 0; b < blocks.size(); b++)
+            chain[b] = b;
+        std::sort(edges.begin(), edges.end(), Heavier);
+        for (auto edge = edges.begin(); edge != edges.end(); edge++)
+        {
+            const LayoutBlock &from = blocks[edge->from];
+            if (blocks[edge->to].address != from.address + from.size)
+                takenBefore += edge->weight;
+            if (next[edge->from] != LAYOUT_NONE || prev[edge->to] != LAYOUT_NONE)
+                continue;
+            UINT32 a = Find(chain, edge->from), b = Find(chain, edge->to);
+            if (a == b)
+                continue;
+            next[edge->from] = edge->to;
+            prev[edge->to] = edge->from;
+            chain[b] = a;
+        }
+        for (auto edge = edges.begin(); edge != edges.end(); edge++)
+            if (next[edge->from] != edge->to)
+                takenAfter += edge->weight;
+    }
+
+    // Pettis-Hansen: merge the chains of the heaviest call edges first
+    VOID OrderRoutines(const std::map<std::pair<UINT32, UINT32>, UINT64> &calls)
+    {
+        std::vector<Edge> edges;
+        for (auto it = calls.begin(); it != calls.end(); it++)
+        {
+            Edge edge = {it->first.first, it->first.second, it->second};
+            edges.push_back(edge);
+        }
+        std::sort(edges.begin(), edges.end(), Heavier);
+
+        std::vector<std::vector<UINT32> > chains(routines.size());
+        std::vector<UINT32> chainOf(routines.size());
+        for (UINT32 r = 0; r < routines.size(); r++)
+        {
+            chainOf[r] = r;
+            if (r && routines[r].instructions)
+                chains[r].push_back(r);
+        }
+        for (auto edge = edges.begin(); edge != edges.end(); edge++)
+        {
+            UINT32 a = chainOf[edge->from], b = chainOf[edge->to];
+            if (a == b)
+                continue;
+            std::vector<UINT32> &first = chains[a], &second = chains[b];
+            // the caller and callee meet where the two chains join
+            if (Position(first, edge->from) < first.size() / 2)
+                std::reverse(first.begin(), first.end());
+            if (Position(second, edge->to) >= (second.size() + 1) / 2)
+                std::reverse(second.begin(), second.end());
+            for (auto r = second.begin(); r != second.end(); r++)
+                chainOf[*r] = a;
+            first.insert(first.end(), second.begin(), second.end());
+            second.clear();
+        }
+
+        std::vector<std::pair<FLT64, UINT32> > heat;
+        for (UINT32 c = 1; c < chains.size(); c++)
+        {
+            if (chains[c].empty())
+                continue;
+            UINT64 ins = 0, bytes = 0;
+            for (auto r = chains[c].begin(); r != chains[c].end(); r++)
+            {
+                ins += routines[*r].instructions;
+                bytes += routines[*r].size;
+            }
+            heat.push_back(std::make_pair(-(FLT64)ins / std::max(bytes, (UINT64)1), c));
+        }
+        std::sort(heat.begin(), heat.end());
+        for (auto it = heat.begin(); it != heat.end(); it++)
+            order.insert(order.end(), chains[it->second].begin(), chains[it->second].end());
+    }
+
+    static size_t Position(const std::vector<UINT32> &chain, UINT32 r)
+    {
+        return std::find(chain.begin(), chain.end(), r) - chain.begin();
+    }
+
+    static inline UINT64 AlignUp(UINT64 offset)
+    {
+        return (offset + LAYOUT_ALIGN - 1) & ~(UINT64)(LAYOUT_ALIGN - 1);
+    }
+
+    // Distinct units of 2^bits bytes the intervals touch
+    static UINT64 Units(const std::vector<std::pair<UINT64, UINT64> > &intervals, UINT32 bits)
+    {
+        std::vector<UINT64> units;
+        for (auto it = intervals.begin(); it != intervals.end(); it++)
+            for (UINT64 u = it->first >> bits; u <= (it->second - 1) >> bits; u++)
+                units.push_back(u);
+        std::sort(units.begin(), units.end());
+        return std::unique(units.begin(), units.end()) - units.begin();
+    }
+
+    static LayoutFootprint Footprint(const std::vector<std::pair<UINT64, UINT64> > &intervals, UINT32 lineBits)
+    {
+        LayoutFootprint footprint;
+        footprint.regions = Units(intervals, 5);
+        footprint.lines = Units(intervals, lineBits);
+        footprint.pages = Units(intervals, 12);
+        return footprint;
+    }
+
+    // Executed bytes per routine, then the footprint of the three layouts
+    VOID Measure(const std::vector<LayoutBlock> &blocks, UINT32 lineBits)
+    {
+        std::vector<std::vector<std::pair<UINT64, UINT64> > > hot(routines.size());
+        for (auto block = blocks.begin(); block != blocks.end(); block++)
+            if (block->executions && block->routine && block->routine < routines.size())
+                hot[block->routine].push_back(std::make_pair(block->address, block->address + block->size));
+        // blocks of different records overlap, merge them into disjoint intervals
+        for (UINT32 r = 1; r < hot.size(); r++)
+        {
+            std::vector<std::pair<UINT64, UINT64> > &intervals = hot[r];
+            std::sort(intervals.begin(), intervals.end());
+            size_t n = 0;
+            for (size_t i = 0; i < intervals.size(); i++)
+            {
+                if (n && intervals[i].first <= intervals[n - 1].second)
+                    intervals[n - 1].second = std::max(intervals[n - 1].second, intervals[i].second);
+                else
+                    intervals[n++] = intervals[i];
+            }
+            intervals.resize(n);
+        }
+
+        std::vector<std::pair<UINT64, UINT64> > now, moved, packed;
+        UINT64 movedEnd = 0, packedEnd = 0;
+        for (auto r = order.begin(); r != order.end(); r++)
+        {
+            LayoutRoutine &routine = routines[*r];
+            if (hot[*r].empty())
+                continue;
+            for (auto it = hot[*r].begin(); it != hot[*r].end(); it++)
+                routine.hotBytes += it->second - it->first;
+            // the executed blocks bound the routine when its symbol size is missing or too small
+            UINT64 origin = std::min(routine.address, hot[*r].front().first);
+            routine.size = std::max(routine.size, hot[*r].back().second - origin);
+            routine.coldBytes = routine.size - routine.hotBytes;
+
+            UINT64 base = AlignUp(movedEnd);
+            UINT64 packedBase = AlignUp(packedEnd);
+            for (auto it = hot[*r].begin(); it != hot[*r].end(); it++)
+            {
+                now.push_back(*it);
+                moved.push_back(std::make_pair(base + it->first - origin, base + it->second - origin));
+                packed.push_back(std::make_pair(packedBase, packedBase + it->second - it->first));
+                packedBase += it->second - it->first;
+            }
+            movedEnd = base + routine.size;
+            packedEnd = packedBase;
+        }
+        before = Footprint(now, lineBits);
+        ordered = Footprint(moved, lineBits);
+        split = Footprint(packed, lineBits);
+    }
+};
+
+#endif
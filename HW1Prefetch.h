@@ -0,0 +1,296 @@
+/*
+ * Data prefetcher model and load stride characterization behind -prefetch.
+ *
+ * The data accesses go through a private L1D with the -l1d geometry, the
+ * demand cache, and its misses are checked against three prefetchers at
+ * once, so one run compares them on the same miss stream:
+ *
+ *   next-line  every miss requests the following line
+ *   stride     a direct mapped reference prediction table (RPT) keyed by the
+ *              load's pc requests addr + stride once the stride repeats
+ *   stream     a few stream trackers follow misses moving up or down through
+ *              nearby lines and request the next lines in that direction
+ *
+ * Each prefetcher fills its own direct mapped prefetch buffer; a demand miss
+ * found there is covered. Prefetches never enter the L1D and timeliness is not
+ * modelled, so coverage is an upper bound. The RPT also classifies every load
+ * as constant stride, irregular or pointer chasing (loads whose address
+ * register they overwrite, like p = p->next).
+ */
+
+#ifndef HW1_PREFETCH_H
+#define HW1_PREFETCH_H
+
+#include "HW1Types.h"
+#include "HW1Cache.h"
+#include <cstdlib>
+#include <cstring>
+
+enum
+{
+    PREFETCHER_NEXT_LINE = 0,
+    PREFETCHER_STRIDE = 1,
+    PREFETCHER_STREAM = 2,
+    PREFETCHER_KINDS = 3
+};
+const char *const prefetcherNames[PREFETCHER_KINDS] = {"next-line", "stride", "stream"};
+
+enum
+{
+    STRIDE_CONSTANT = 0,
+    STRIDE_IRREGULAR = 1,
+    STRIDE_CHASE = 2,
+    STRIDE_CLASSES = 3
+};
+const char *const strideClassNames[STRIDE_CLASSES] = {"constant", "irregular", "pointer chase"};
+
+// Access flags
+enum
+{
+    PREFETCH_READ = 1,
+    PREFETCH_CHASE = 2
+};
+
+#define PREFETCH_BUFFER_BITS 10
+#define PREFETCH_STREAMS 16
+#define PREFETCH_STREAM_WINDOW 4 // lines a miss may be away from a stream to extend it
+#define MAX_PREFETCH_DEGREE 16
+
+class PrefetchModel
+{
+  public:
+    UINT64 misses; // demand misses of the L1D, with no prefetching
+    UINT64 issued[PREFETCHER_KINDS];
+    UINT64 useful[PREFETCHER_KINDS];
+    UINT64 loads[STRIDE_CLASSES];       // dynamic loads, the first one of a table entry is not classified
+    UINT64 staticLoads[STRIDE_CLASSES]; // table entries, by the class of most of their loads
+
+    PrefetchModel() : misses(0), enabled(FALSE), lineBits(0), table(0), tableMask(0), degree(0), nextStream(0)
+    {
+        for (UINT32 i = 0; i < PREFETCHER_KINDS; i++)
+            buffer[i] = 0;
+        ResetStats();
+    }
+    PrefetchModel(const PrefetchModel &) = delete;
+    PrefetchModel &operator=(const PrefetchModel &) = delete;
+
+    ~PrefetchModel()
+    {
+        free(table);
+        for (UINT32 i = 0; i < PREFETCHER_KINDS; i++)
+            free(buffer[i]);
+    }
+
+    VOID Init(const CacheConfig &l1dConfig, UINT32 policy, UINT32 tableBits, UINT32 prefetchDegree)
+    {
+        l1d.Init(l1dConfig, policy);
+        lineBits = l1d.LineBits();
+        tableMask = ((UINT64)1 << tableBits) - 1;
+        table = (RptEntry *)calloc(tableMask + 1, sizeof(RptEntry));
+        for (UINT32 i = 0; i < PREFETCHER_KINDS; i++)
+        {
+            buffer[i] = (UINT64 *)malloc(sizeof(UINT64) << PREFETCH_BUFFER_BITS);
+            memset(buffer[i], 0xff, sizeof(UINT64) << PREFETCH_BUFFER_BITS);
+        }
+        memset(streams, 0, sizeof(streams));
+        degree = prefetchDegree;
+        enabled = TRUE;
+    }
+
+    inline BOOL Enabled() const
+    {
+        return enabled;
+    }
+
+    // One data access of the instruction at pc, returns TRUE if a prefetcher
+    // had requested one of its lines or the load's stride predicted it
+    inline BOOL Access(UINT64 pc, UINT64 addr, UINT32 size, UINT32 flags)
+    {
+        if (!enabled || size == 0)
+            return FALSE;
+        BOOL covered = FALSE;
+        for (UINT64 line = addr >> lineBits; line <= (addr + size - 1) >> lineBits; line++)
+        {
+            if (l1d.Access(line << lineBits))
+                continue;
+            misses++;
+            for (UINT32 i = 0; i < PREFETCHER_KINDS; i++)
+                if (Take(i, line))
+                {
+                    useful[i]++;
+                    covered = TRUE;
+                }
+            for (UINT32 d = 1; d <= degree; d++)
+                Issue(PREFETCHER_NEXT_LINE, line + d);
+            Stream(line);
+        }
+        BOOL predicted = (flags & PREFETCH_READ) ? Train(pc, addr, flags & PREFETCH_CHASE) : FALSE;
+        return covered || predicted;
+    }
+
+    // Start a new window, the L1D, table and streams stay warm
+    VOID ResetStats()
+    {
+        misses = 0;
+        for (UINT32 i = 0; i < PREFETCHER_KINDS; i++)
+            issued[i] = useful[i] = 0;
+        for (UINT32 i = 0; i < STRIDE_CLASSES; i++)
+            loads[i] = staticLoads[i] = 0;
+        for (UINT64 i = 0; table && i <= tableMask; i++)
+            table[i].hits = table[i].seen = 0;
+    }
+
+    // Also classifies the entries still in the other table
+    VOID MergeStats(const PrefetchModel &other)
+    {
+        misses += other.misses;
+        for (UINT32 i = 0; i < PREFETCHER_KINDS; i++)
+        {
+            issued[i] += other.issued[i];
+            useful[i] += other.useful[i];
+        }
+        for (UINT32 i = 0; i < STRIDE_CLASSES; i++)
+        {
+            loads[i] += other.loads[i];
+            staticLoads[i] += other.staticLoads[i];
+        }
+        for (UINT64 i = 0; other.table && i <= other.tableMask; i++)
+            if (other.table[i].seen)
+                staticLoads[Classify(other.table[i])]++;
+    }
+
+  private:
+    typedef struct _RptEntry
+    {
+        UINT64 pc;
+        UINT64 last;
+        INT64 stride;
+        UINT32 confidence; // 0-3, prefetching from 2
+        UINT32 chase;
+        UINT32 hits; // loads of the window that repeated the stride
+        UINT32 seen; // classified loads of the window
+    } RptEntry;
+
+    typedef struct _StreamEntry
+    {
+        UINT64 line;
+        INT32 direction;
+        UINT32 confidence;
+    } StreamEntry;
+
+    BOOL enabled;
+    Cache l1d;
+    UINT32 lineBits;
+    RptEntry *table;
+    UINT64 tableMask;
+    UINT64 *buffer[PREFETCHER_KINDS]; // requested lines, direct mapped
+    StreamEntry streams[PREFETCH_STREAMS];
+    UINT32 degree;
+    UINT32 nextStream; // round robin replacement
+
+    static inline UINT32 Classify(const RptEntry &entry)
+    {
+        if (2 * entry.hits >= entry.seen)
+            return STRIDE_CONSTANT;
+        return entry.chase ? STRIDE_CHASE : STRIDE_IRREGULAR;
+    }
+
+    inline VOID Issue(UINT32 kind, UINT64 line)
+    {
+        UINT64 &slot = buffer[kind][line & (((UINT64)1 << PREFETCH_BUFFER_BITS) - 1)];
+        // lines already cached or requested are filtered, like a real prefetch queue
+        if (slot == line || l1d.Contains(line << lineBits))
+            return;
+        slot = line;
+        issued[kind]++;
+    }
+
+    inline BOOL Take(UINT32 kind, UINT64 line)
+    {
+        UINT64 &slot = buffer[kind][line & (((UINT64)1 << PREFETCH_BUFFER_BITS) - 1)];
+        if (slot != line)
+            return FALSE;
+        slot = CACHE_INVALID_TAG;
+        return TRUE;
+    }
+
+    // Returns TRUE if the entry predicted addr
+    inline BOOL Train(UINT64 pc, UINT64 addr, BOOL chase)
+    {
+        RptEntry &entry = table[(pc ^ (pc >> 12)) & tableMask];
+        if (entry.pc != pc)
+        {
+            if (entry.seen)
+                staticLoads[Classify(entry)]++;
+            entry.pc = pc;
+            entry.last = addr;
+            entry.stride = 0;
+            entry.confidence = 0;
+            entry.chase = chase;
+            entry.hits = 0;
+            entry.seen = 0;
+            return FALSE;
+        }
+        INT64 delta = (INT64)(addr - entry.last);
+        BOOL predicted = entry.confidence >= 2 && delta == entry.stride;
+        entry.seen++;
+        if (delta == entry.stride)
+        {
+            entry.hits++;
+            loads[STRIDE_CONSTANT]++;
+            if (entry.confidence < 3)
+                entry.confidence++;
+        }
+        else
+        {
+            loads[entry.chase ? STRIDE_CHASE : STRIDE_IRREGULAR]++;
+            if (entry.confidence > 0)
+                entry.confidence--;
+            else
+                entry.stride = delta;
+        }
+        entry.last = addr;
+        if (entry.confidence >= 2 && entry.stride != 0)
+            for (UINT32 d = 1; d <= degree; d++)
+            {
+                UINT64 line = (addr + d * entry.stride) >> lineBits;
+                if (line != addr >> lineBits)
+                    Issue(PREFETCHER_STRIDE, line);
+            }
+        return predicted;
+    }
+
+    inline VOID Stream(UINT64 line)
+    {
+        for (UINT32 i = 0; i < PREFETCH_STREAMS; i++)
+        {
+            StreamEntry &stream = streams[i];
+            INT64 delta = (INT64)(line - stream.line);
+            if (stream.confidence == 0 || delta == 0 || delta > PREFETCH_STREAM_WINDOW || delta < -PREFETCH_STREAM_WINDOW)
+                continue;
+            INT32 direction = delta > 0 ? 1 : -1;
+            if (direction == stream.direction)
+            {
+                if (stream.confidence < 3)
+                    stream.confidence++;
+            }
+            else
+            {
+                stream.direction = direction;
+                stream.confidence = 1;
+            }
+            stream.line = line;
+            if (stream.confidence >= 2)
+                for (UINT32 d = 1; d <= degree; d++)
+                    Issue(PREFETCHER_STREAM, line + (INT64)d * direction);
+            return;
+        }
+        StreamEntry &stream = streams[nextStream];
+        nextStream = (nextStream + 1) % PREFETCH_STREAMS;
+        stream.line = line;
+        stream.direction = 0;
+        stream.confidence = 1;
+    }
+};
+
+#endif
@@ -0,0 +1,536 @@
+/*
+ * HW1Replay: run the HW1 Part A-D analyses and the cache model on a trace
+ * captured with -trace, without Pin.
+ *
+ * Usage: HW1Replay [-o file] [-j threads] [-cache 0|1] [-l1d spec] [-l1i spec] [-l2 spec] [-llc spec]
+ *                  [-mem_latency n] [-cache_policy name] prefix
+ *
+ * Reads <prefix>.static.hw1t and every <prefix>.<tid>.hw1t. Trace chunks decode
+ * on their own and Part A-D only sums, ORs and takes min/max, so the chunks are
+ * spread over a work stealing pool, each worker counts into its own metrics and
+ * the workers are merged at the end. The cache model depends on access order:
+ * it runs as one task per thread file, next to the chunk tasks. The merged
+ * report is the one the tool prints with -bbl_summary 1, whatever -j is.
+ */
+
+#include "HW1Core.h"
+#include "HW1Trace.h"
+#include <iostream>
+#include <fstream>
+#include <unordered_map>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+
+// Basic block records of the static file, looked up by (address, instructions)
+class BlockIndex
+{
+  public:
+    vector<BblSummary *> blocks; // by id, 0 is unused
+    std::unordered_map<UINT64, const InsSummary *> ins;
+    UINT32 addressBits; // of the traced program
+    UINT64 windowStart; // of the captured window
+    UINT32 windowIndex;
+
+    BlockIndex() : blocks(1, (BblSummary *)0), addressBits(64), windowStart(0), windowIndex(0) {}
+
+    ~BlockIndex()
+    {
+        for (size_t i = 1; i < blocks.size(); i++)
+            delete blocks[i];
+    }
+
+    BOOL Load(const string &fileName)
+    {
+        std::ifstream file(fileName.c_str(), std::ios::binary);
+        HW1StaticHeader header;
+        if (!file.read((char *)&header, sizeof(header)) || memcmp(header.magic, HW1_STATIC_MAGIC, 4) != 0 || header.version != HW1_TRACE_VERSION)
+            return FALSE;
+        addressBits = header.addressBits;
+        windowStart = header.windowStart;
+        windowIndex = header.windowIndex;
+        for (UINT32 b = 0; b < header.numBlocks; b++)
+        {
+            HW1StaticBlock block;
+            if (!file.read((char *)&block, sizeof(block)))
+                return FALSE;
+            BblSummary *summary = new BblSummary();
+            summary->id = blocks.size();
+            summary->numIns = block.numIns;
+            summary->ins.resize(block.numSummaries);
+            if (block.numSummaries && !file.read((char *)summary->ins.data(), block.numSummaries * sizeof(InsSummary)))
+            {
+                delete summary;
+                return FALSE;
+            }
+            blocks.push_back(summary);
+            ids[Key(block.address, block.numIns)] = summary->id;
+        }
+        // predicated instructions are looked up by address, the others never are
+        for (size_t i = 1; i < blocks.size(); i++)
+            for (auto it = blocks[i]->ins.begin(); it != blocks[i]->ins.end(); it++)
+                if (it->predicated)
+                    ins[it->insAddr] = &*it;
+        return TRUE;
+    }
+
+    // Block id, 0 if the static file does not know the block. Read only, shared by all workers.
+    UINT32 Find(UINT64 key) const
+    {
+        auto it = ids.find(key);
+        return it == ids.end() ? 0 : it->second;
+    }
+
+    static inline UINT64 Key(UINT64 address, UINT64 numIns)
+    {
+        return (address << 16) ^ numIns;
+    }
+
+  private:
+    std::unordered_map<UINT64, UINT32> ids;
+};
+
+// Feeds trace records into Part A-D metrics the way the tool's analysis routines would.
+// One per worker; the cache model is left to CacheReplayer.
+class Replayer
+{
+  public:
+    Metrics *m;
+    UINT64 insCount;
+    UINT64 records;
+    UINT64 unknownBlocks;
+    UINT64 badChunks; // ending in the middle of a record
+
+    Replayer(Metrics *metrics, const BlockIndex &blockIndex)
+        : m(metrics), insCount(0), records(0), unknownBlocks(0), badChunks(0), index(blockIndex), predicatedIns(0), predicatedLeft(0)
+    {
+        m->bblExec.assign(index.blocks.size(), 0);
+        memset(memo, 0, sizeof(memo));
+    }
+
+    // Pin never splits the records of one instruction over two buffers, so a chunk starts with a new instruction
+    VOID BeginChunk()
+    {
+        predicatedIns = 0;
+        predicatedLeft = 0;
+    }
+
+    inline VOID Record(UINT32 type, UINT64 ip, UINT64 ea, UINT32 size)
+    {
+        records++;
+        if (type == TRACE_BLOCK)
+        {
+            UINT32 id = Find(ip, ea);
+            if (id == 0)
+                unknownBlocks++;
+            m->bblExec[id]++;
+            insCount += ea;
+            return;
+        }
+        if (type == TRACE_EXEC)
+        {
+            const InsSummary *ins = Lookup(ip);
+            if (ins)
+                m->RecordNoMemIns(ins->insTypeOffset);
+            return;
+        }
+        m->RecordData(ea, size);
+        if (!(type & TRACE_PREDICATED))
+            return;
+
+        // one execution of a predicated instruction writes one record per memory operand
+        if (predicatedLeft == 0 || predicatedIns == 0 || predicatedIns->insAddr != ip)
+        {
+            predicatedIns = Lookup(ip);
+            if (predicatedIns == 0)
+                return;
+            predicatedLeft = predicatedIns->memOperands;
+            m->RecordMemIns(predicatedIns->insTypeOffset, predicatedIns->numLoads, predicatedIns->numStores, predicatedIns->readOperands,
+                            predicatedIns->writeOperands, predicatedIns->displacementMax, predicatedIns->displacementMin);
+            m->RecordMemTouched(predicatedIns->memTouched);
+        }
+        predicatedLeft--;
+    }
+
+    // Add the block counts into the metrics, like FoldBblSummaries in the tool
+    VOID Fold()
+    {
+        for (size_t id = 1; id < index.blocks.size(); id++)
+            if (m->bblExec[id])
+                m->FoldBlock(index.blocks[id], m->bblExec[id]);
+    }
+
+  private:
+    static const UINT32 MEMO_SIZE = 4096;
+    typedef struct _Memo
+    {
+        UINT64 key;
+        UINT32 id;
+    } Memo;
+
+    const BlockIndex &index;
+    const InsSummary *predicatedIns;
+    UINT32 predicatedLeft;
+    Memo memo[MEMO_SIZE]; // direct mapped in front of the block index
+
+    inline UINT32 Find(UINT64 address, UINT64 numIns)
+    {
+        UINT64 key = BlockIndex::Key(address, numIns);
+        Memo &entry = memo[(key ^ (key >> 12)) & (MEMO_SIZE - 1)];
+        if (entry.id && entry.key == key)
+            return entry.id;
+        entry.key = key;
+        entry.id = index.Find(key);
+        return entry.id;
+    }
+
+    const InsSummary *Lookup(UINT64 ip)
+    {
+        auto it = index.ins.find(ip);
+        return it == index.ins.end() ? 0 : it->second;
+    }
+};
+
+static BOOL Fail(const string &fileName, const char *message)
+{
+    fprintf(stderr, "HW1Replay: %s: %s\n", fileName.c_str(), message);
+    return FALSE;
+}
+
+// Replays the instruction fetches and data accesses of one thread file, in order
+class CacheReplayer
+{
+  public:
+    CacheHierarchy &caches;
+
+    CacheReplayer(CacheHierarchy &hierarchy) : caches(hierarchy) {}
+
+    inline VOID Record(UINT32 type, UINT64 ip, UINT64 ea, UINT32 size)
+    {
+        if (type == TRACE_BLOCK)
+            caches.Fetch(ip, size);
+        else if (type != TRACE_EXEC)
+            caches.Data(ea, size);
+    }
+};
+
+typedef struct _TraceChunk
+{
+    const UINT8 *data;
+    UINT32 bytes;
+    UINT32 records;
+} TraceChunk;
+
+// One mapped per thread trace file and its chunks
+typedef struct _TraceFile
+{
+    string name;
+    VOID *data;
+    size_t size;
+    UINT32 format;
+    vector<TraceChunk> chunks;
+    CacheHierarchy *caches;
+} TraceFile;
+
+static BOOL MapTraceFile(TraceFile &file)
+{
+    file.data = 0;
+    int fd = open(file.name.c_str(), O_RDONLY);
+    if (fd < 0)
+        return Fail(file.name, "cannot open");
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (UINT64)st.st_size < sizeof(HW1TraceHeader))
+    {
+        close(fd);
+        return Fail(file.name, "too small");
+    }
+    VOID *data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return Fail(file.name, "cannot map");
+    file.data = data;
+    file.size = st.st_size;
+
+    const UINT8 *pos = (const UINT8 *)data;
+    const UINT8 *end = pos + st.st_size;
+    const HW1TraceHeader *header = (const HW1TraceHeader *)pos;
+    if (memcmp(header->magic, HW1_TRACE_MAGIC, 4) != 0 || header->version != HW1_TRACE_VERSION)
+        return Fail(file.name, "not a HW1 trace of this version");
+    file.format = header->format;
+    pos += sizeof(HW1TraceHeader);
+    while ((size_t)(end - pos) >= sizeof(HW1TraceChunkHeader))
+    {
+        // varint chunks leave the next header unaligned
+        HW1TraceChunkHeader chunk;
+        memcpy(&chunk, pos, sizeof(chunk));
+        pos += sizeof(HW1TraceChunkHeader);
+        if (chunk.bytes > (size_t)(end - pos))
+        {
+            // a killed run can leave a partial last chunk
+            Fail(file.name, "truncated chunk ignored");
+            break;
+        }
+        TraceChunk traceChunk = {pos, chunk.bytes, chunk.records};
+        file.chunks.push_back(traceChunk);
+        pos += chunk.bytes;
+    }
+    return TRUE;
+}
+
+// A chunk for the Part A-D replay, or a whole file for the cache model when chunk is 0
+typedef struct _ReplayTask
+{
+    const TraceFile *file;
+    const TraceChunk *chunk;
+} ReplayTask;
+
+// Fixed set of tasks dealt to per worker queues up front. A worker takes its own
+// tasks from the back and, once they run out, steals from the front of the others.
+class TaskPool
+{
+  public:
+    TaskPool(UINT32 workers) : queues(workers), locks(workers) {}
+
+    VOID Push(UINT32 worker, const ReplayTask &task)
+    {
+        queues[worker].push_back(task);
+    }
+
+    BOOL Next(UINT32 worker, ReplayTask &task)
+    {
+        for (UINT32 i = 0; i < queues.size(); i++)
+        {
+            UINT32 victim = (worker + i) % queues.size();
+            std::lock_guard<std::mutex> lock(locks[victim]);
+            std::deque<ReplayTask> &queue = queues[victim];
+            if (queue.empty())
+                continue;
+            if (i == 0)
+            {
+                task = queue.back();
+                queue.pop_back();
+            }
+            else
+            {
+                task = queue.front();
+                queue.pop_front();
+            }
+            return TRUE;
+        }
+        return FALSE;
+    }
+
+  private:
+    vector<std::deque<ReplayTask> > queues;
+    vector<std::mutex> locks;
+};
+
+static VOID RunWorker(TaskPool *pool, UINT32 worker, Replayer *replayer)
+{
+    ReplayTask task;
+    while (pool->Next(worker, task))
+    {
+        if (task.chunk)
+        {
+            replayer->BeginChunk();
+            if (!DecodeTraceChunk(task.file->format, task.chunk->data, task.chunk->bytes, task.chunk->records, *replayer))
+                replayer->badChunks++;
+            continue;
+        }
+        // the chunk tasks count the bad chunks
+        CacheReplayer cacheReplayer(*task.file->caches);
+        for (auto chunk = task.file->chunks.begin(); chunk != task.file->chunks.end(); chunk++)
+            DecodeTraceChunk(task.file->format, chunk->data, chunk->bytes, chunk->records, cacheReplayer);
+    }
+}
+
+static int Usage()
+{
+    fprintf(stderr, "Usage: HW1Replay [-o file] [-j threads] [-cache 0|1] [-l1d spec] [-l1i spec] [-l2 spec] [-llc spec]\n"
+                    "                 [-mem_latency n] [-cache_policy lru|plru|fifo|random] prefix\n"
+                    "Cache specs are size in KB:ways:line bytes:latency, as for the pin tool, -cache defaults to 0.\n"
+                    "-j defaults to one thread per core.\n");
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    string outputFile, prefix, policyName = "lru";
+    BOOL cacheModel = FALSE;
+    UINT32 memLatency = 70;
+    UINT32 numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    string specs[CACHE_LEVELS] = {"32:8:64:1", "32:8:64:1", "256:8:64:10", "2048:16:64:30"};
+    const char *specFlags[CACHE_LEVELS] = {"-l1d", "-l1i", "-l2", "-llc"};
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        BOOL hasValue = i + 1 < argc;
+        BOOL matched = FALSE;
+        for (UINT32 level = 0; level < CACHE_LEVELS; level++)
+            if (arg == specFlags[level] && hasValue)
+            {
+                specs[level] = argv[++i];
+                matched = TRUE;
+            }
+        if (matched)
+            continue;
+        if (arg == "-o" && hasValue)
+            outputFile = argv[++i];
+        else if (arg == "-j" && hasValue)
+            numWorkers = std::max(1, atoi(argv[++i]));
+        else if (arg == "-cache" && hasValue)
+            cacheModel = atoi(argv[++i]) != 0;
+        else if (arg == "-mem_latency" && hasValue)
+            memLatency = atoi(argv[++i]);
+        else if (arg == "-cache_policy" && hasValue)
+            policyName = argv[++i];
+        else if (!arg.empty() && arg[0] == '-')
+            return Usage();
+        else
+            prefix = arg;
+    }
+    if (prefix.empty())
+        return Usage();
+
+    CacheConfig cacheConfigs[CACHE_LEVELS];
+    UINT32 policy = CACHE_POLICY_LRU;
+    for (UINT32 level = 0; level < CACHE_LEVELS; level++)
+        if (!ParseCacheConfig(specs[level], cacheConfigs[level], level >= CACHE_L2))
+        {
+            fprintf(stderr, "HW1Replay: bad %s cache %s\n", cacheLevelNames[level], specs[level].c_str());
+            return Usage();
+        }
+    if (!ParseCachePolicy(policyName, policy))
+    {
+        fprintf(stderr, "HW1Replay: unknown cache policy %s\n", policyName.c_str());
+        return Usage();
+    }
+
+    BlockIndex index;
+    if (!index.Load(prefix + ".static.hw1t"))
+        return Fail(prefix + ".static.hw1t", "cannot read the block records"), 1;
+
+    vector<string> traceFiles;
+    glob_t matches;
+    if (glob((prefix + ".*.hw1t").c_str(), 0, 0, &matches) == 0)
+    {
+        for (size_t i = 0; i < matches.gl_pathc; i++)
+            if (string(matches.gl_pathv[i]) != prefix + ".static.hw1t")
+                traceFiles.push_back(matches.gl_pathv[i]);
+        globfree(&matches);
+    }
+    if (traceFiles.empty())
+        return Fail(prefix, "no trace files"), 1;
+
+    ReportInfo info;
+    info.outputFile = outputFile;
+    info.insCount = index.windowStart; // the replayed instructions are added below
+    info.windowStart = index.windowStart;
+    info.windowIndex = index.windowIndex;
+    info.numWindows = 1;
+    info.cacheConfigs = cacheModel ? cacheConfigs : 0;
+    info.cachePolicy = policyName;
+    info.memLatency = memLatency;
+    info.branchPredictors = 0; // the trace holds no branch outcomes
+    info.numBranchPredictors = 0;
+    info.branchPenalty = 0;
+    info.prefetchDegree = 0;
+    info.robSize = 0;
+    info.issueWidth = 0;
+    info.tlbConfigs = 0;
+    info.pageWalk = 0;
+    info.reuseRate = 0;
+    info.reuseInterval = 0;
+    info.metrics = METRIC_ALL;
+    info.addressBits = index.addressBits;
+    info.startTime = std::chrono::system_clock::now();
+
+    int status = 0;
+    vector<TraceFile> files(traceFiles.size());
+    for (size_t f = 0; f < files.size(); f++)
+    {
+        files[f].name = traceFiles[f];
+        files[f].caches = 0;
+        if (!MapTraceFile(files[f]))
+            status = 1;
+    }
+
+    // chunks round robin, then the long cache model tasks so that their owners start them first
+    TaskPool pool(numWorkers);
+    UINT32 next = 0;
+    for (size_t f = 0; f < files.size(); f++)
+        for (size_t c = 0; c < files[f].chunks.size(); c++)
+        {
+            ReplayTask task = {&files[f], &files[f].chunks[c]};
+            pool.Push(next++ % numWorkers, task);
+        }
+    for (size_t f = 0; f < files.size() && cacheModel; f++)
+    {
+        files[f].caches = new CacheHierarchy();
+        files[f].caches->Init(cacheConfigs, policy, memLatency);
+        ReplayTask task = {&files[f], 0};
+        pool.Push(f % numWorkers, task);
+    }
+
+    vector<Metrics *> metrics(numWorkers);
+    vector<Replayer *> replayers(numWorkers);
+    vector<std::thread> threads;
+    for (UINT32 w = 0; w < numWorkers; w++)
+    {
+        metrics[w] = new Metrics();
+        replayers[w] = new Replayer(metrics[w], index);
+    }
+    for (UINT32 w = 1; w < numWorkers; w++)
+        threads.push_back(std::thread(RunWorker, &pool, w, replayers[w]));
+    RunWorker(&pool, 0, replayers[0]);
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+
+    UINT64 records = 0, unknownBlocks = 0, badChunks = 0;
+    Metrics *total = new Metrics();
+    for (UINT32 w = 0; w < numWorkers; w++)
+    {
+        replayers[w]->Fold();
+        total->Merge(*metrics[w]);
+        info.insCount += replayers[w]->insCount;
+        records += replayers[w]->records;
+        unknownBlocks += replayers[w]->unknownBlocks;
+        badChunks += replayers[w]->badChunks;
+        delete replayers[w];
+        delete metrics[w];
+    }
+    for (size_t f = 0; f < files.size(); f++)
+    {
+        if (files[f].caches)
+            total->caches.MergeStats(*files[f].caches);
+        delete files[f].caches;
+        if (files[f].data)
+            munmap(files[f].data, files[f].size);
+    }
+
+    std::chrono::duration<double> seconds = std::chrono::system_clock::now() - info.startTime;
+    std::ofstream file;
+    if (!outputFile.empty())
+        file.open(outputFile.c_str());
+    PrintResults(outputFile.empty() ? std::cout : file, total, info);
+    fprintf(stderr, "HW1Replay: %llu records from %zu files in %.2f s on %u threads, %.1f M records/s\n", (unsigned long long)records,
+            traceFiles.size(), seconds.count(), numWorkers, records / seconds.count() / 1e6);
+    if (unknownBlocks)
+        fprintf(stderr, "HW1Replay: %llu blocks missing from the static file\n", (unsigned long long)unknownBlocks);
+    if (badChunks)
+    {
+        fprintf(stderr, "HW1Replay: %llu chunks end in the middle of a record, replayed up to it\n", (unsigned long long)badChunks);
+        status = 1;
+    }
+    delete total;
+    return status;
+}
@@ -0,0 +1,182 @@
+/*
+ * Binary columnar result format of the HW1 tool (-ob), read back by HW1Dump.
+ *
+ * Layout, all integers little endian:
+ *   HW1FileHeader
+ *   numTables x { HW1TableHeader, numColumns x HW1ColumnHeader }
+ *   column data, 8 bytes per value, width values per row, rows back to back
+ * Every column starts at the absolute file offset given in its header.
+ */
+
+#ifndef HW1_RESULT_H
+#define HW1_RESULT_H
+
+#include "HW1Types.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+
+#define HW1_RESULT_MAGIC "HW1R"
+#define HW1_RESULT_VERSION 1
+
+enum
+{
+    HW1_COLUMN_U64 = 0,
+    HW1_COLUMN_I64 = 1,
+    HW1_COLUMN_F64 = 2
+};
+
+typedef struct _HW1FileHeader
+{
+    char magic[4];
+    UINT32 version;
+    UINT32 numTables;
+    UINT32 reserved;
+} HW1FileHeader;
+
+typedef struct _HW1TableHeader
+{
+    char name[24];
+    UINT32 numColumns;
+    UINT32 reserved;
+    UINT64 numRows;
+} HW1TableHeader;
+
+typedef struct _HW1ColumnHeader
+{
+    char name[32];
+    UINT32 type;
+    UINT32 width; // values per row, histograms are stored as one wide column
+    UINT64 offset;
+} HW1ColumnHeader;
+
+// One table being filled row by row; Put() walks the columns in order
+class HW1ResultTable
+{
+  public:
+    HW1ResultTable(const std::string &tableName) : name(tableName), next(0) {}
+
+    VOID AddColumn(const std::string &columnName, UINT32 type, UINT32 width = 1)
+    {
+        Column column;
+        column.name = columnName;
+        column.type = type;
+        column.width = width;
+        columns.push_back(column);
+    }
+
+    VOID Put(UINT64 value)
+    {
+        Column &column = columns[next];
+        column.values.push_back(value);
+        if (column.values.size() % column.width == 0)
+            next = (next + 1) % columns.size();
+    }
+
+    VOID PutI64(INT64 value)
+    {
+        Put((UINT64)value);
+    }
+
+    VOID PutF64(FLT64 value)
+    {
+        UINT64 bits;
+        memcpy(&bits, &value, sizeof(bits));
+        Put(bits);
+    }
+
+    UINT64 NumRows() const
+    {
+        return columns.empty() ? 0 : columns.back().values.size() / columns.back().width;
+    }
+
+  private:
+    friend class HW1ResultWriter;
+
+    typedef struct _Column
+    {
+        std::string name;
+        UINT32 type;
+        UINT32 width;
+        std::vector<UINT64> values;
+    } Column;
+
+    std::string name;
+    std::vector<Column> columns;
+    UINT32 next;
+};
+
+class HW1ResultWriter
+{
+  public:
+    ~HW1ResultWriter()
+    {
+        for (size_t i = 0; i < tables.size(); i++)
+            delete tables[i];
+    }
+
+    HW1ResultTable *AddTable(const std::string &name)
+    {
+        tables.push_back(new HW1ResultTable(name));
+        return tables.back();
+    }
+
+    // Lay the whole file out in memory and write it with a single call
+    BOOL Write(const std::string &fileName) const
+    {
+        UINT64 size = sizeof(HW1FileHeader);
+        for (size_t t = 0; t < tables.size(); t++)
+            size += sizeof(HW1TableHeader) + tables[t]->columns.size() * sizeof(HW1ColumnHeader);
+        UINT64 dataOffset = size;
+        for (size_t t = 0; t < tables.size(); t++)
+            for (size_t c = 0; c < tables[t]->columns.size(); c++)
+                size += tables[t]->NumRows() * tables[t]->columns[c].width * sizeof(UINT64);
+
+        std::vector<char> buffer(size, 0);
+        char *pos = &buffer[0];
+
+        HW1FileHeader *fileHeader = (HW1FileHeader *)pos;
+        memcpy(fileHeader->magic, HW1_RESULT_MAGIC, 4);
+        fileHeader->version = HW1_RESULT_VERSION;
+        fileHeader->numTables = tables.size();
+        pos += sizeof(HW1FileHeader);
+
+        for (size_t t = 0; t < tables.size(); t++)
+        {
+            const HW1ResultTable *table = tables[t];
+            UINT64 rows = table->NumRows();
+            HW1TableHeader *tableHeader = (HW1TableHeader *)pos;
+            strncpy(tableHeader->name, table->name.c_str(), sizeof(tableHeader->name) - 1);
+            tableHeader->numColumns = table->columns.size();
+            tableHeader->numRows = rows;
+            pos += sizeof(HW1TableHeader);
+
+            for (size_t c = 0; c < table->columns.size(); c++)
+            {
+                const HW1ResultTable::Column &column = table->columns[c];
+                HW1ColumnHeader *columnHeader = (HW1ColumnHeader *)pos;
+                strncpy(columnHeader->name, column.name.c_str(), sizeof(columnHeader->name) - 1);
+                columnHeader->type = column.type;
+                columnHeader->width = column.width;
+                columnHeader->offset = dataOffset;
+                pos += sizeof(HW1ColumnHeader);
+
+                // a partially filled last row is dropped
+                UINT64 bytes = rows * column.width * sizeof(UINT64);
+                if (bytes)
+                    memcpy(&buffer[dataOffset], &column.values[0], bytes);
+                dataOffset += bytes;
+            }
+        }
+
+        std::ofstream file(fileName.c_str(), std::ios::binary);
+        file.write(&buffer[0], buffer.size());
+        return file.good();
+    }
+
+  private:
+    std::vector<HW1ResultTable *> tables;
+};
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ * Reuse distance (LRU stack distance) and working set profile of the 32 byte
+ * data blocks that PART C counts, fed the same block stream as RECORDFOOTPRINT.
+ *
+ * Exact mode keeps the last access time of every block and one mark per block
+ * at that time in a Fenwick tree, so the distance of an access is the number
+ * of marks after the block's previous access: O(log M) per access for M
+ * blocks. Times are renumbered when the tree is full, which bounds it by the
+ * number of blocks rather than the number of accesses.
+ *
+ * Sampled mode (SHARDS) only follows blocks whose hash is below a threshold,
+ * i.e. a fraction rate of the blocks, and scales distances and counts by
+ * 1 / rate. When more than budget blocks are followed the threshold is lowered
+ * and the blocks above it are dropped, so memory stays bounded. The stats
+ * keep the lowest rate they were counted at, merging takes the lowest of all.
+ */
+
+#ifndef HW1_REUSE_H
+#define HW1_REUSE_H
+
+#include "HW1Types.h"
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+// Bucket 0 holds distance 0, bucket i distances [2^(i-1), 2^i)
+#define REUSE_BUCKETS 40
+#define REUSE_HASH_BITS 24
+#define REUSE_MIN_TIMES (1 << 16)
+
+class ReuseProfile
+{
+  public:
+    FLT64 accesses;
+    FLT64 cold; // first accesses, infinite distance
+    FLT64 rate; // lowest fraction of the blocks followed while counting, 0 without a profile
+    FLT64 bucket[REUSE_BUCKETS];
+    std::vector<FLT64> workingSet; // distinct blocks per interval of accesses
+
+    ReuseProfile() : accesses(0), cold(0), rate(0), enabled(FALSE), threshold(0), budget(0), interval(0), rawAccesses(0), windowStart(0), firstInterval(0), now(0), live(0)
+    {
+        ResetStats();
+    }
+    ReuseProfile(const ReuseProfile &) = delete;
+    ReuseProfile &operator=(const ReuseProfile &) = delete;
+
+    // rate 1 is exact, below 1 samples that fraction of the blocks within a budget of followed blocks
+    VOID Init(FLT64 rate, UINT64 maxBlocks, UINT64 accessesPerInterval)
+    {
+        enabled = TRUE;
+        threshold = rate >= 1 ? (1 << REUSE_HASH_BITS) : (UINT32)(rate * (1 << REUSE_HASH_BITS));
+        if (threshold == 0)
+            threshold = 1;
+        budget = rate >= 1 ? 0 : maxBlocks;
+        interval = accessesPerInterval ? accessesPerInterval : 1;
+        marks.assign(REUSE_MIN_TIMES + 1, 0);
+        rate = Rate();
+    }
+
+    inline BOOL Enabled() const
+    {
+        return enabled;
+    }
+
+    // Fraction of the blocks currently followed
+    inline FLT64 Rate() const
+    {
+        return threshold * 1.0 / (1 << REUSE_HASH_BITS);
+    }
+
+    inline VOID Insert(UINT64 block)
+    {
+        // intervals restart at the window start, numbered after those of the previous windows
+        UINT64 intervalIndex = firstInterval + (rawAccesses++ - windowStart) / interval;
+        if (Hash(block) >= threshold)
+            return;
+        FLT64 weight = 1.0 / Rate();
+        accesses += weight;
+
+        // times start at 1, 0 marks a block seen for the first time
+        if (now + 1 >= marks.size())
+            Compact();
+        BlockState &state = blocks[block];
+        if (state.time == 0)
+        {
+            cold += weight;
+            live++;
+        }
+        else
+        {
+            // marks after the previous access are the distinct blocks touched since
+            UINT64 distance = (UINT64)((live - Prefix(state.time)) * weight);
+            bucket[Bucket(distance)] += weight;
+            Add(state.time, -1);
+        }
+        if (state.time == 0 || state.interval != intervalIndex)
+        {
+            if (intervalIndex >= firstInterval + workingSet.size())
+                workingSet.resize(intervalIndex - firstInterval + 1, 0);
+            workingSet[intervalIndex - firstInterval] += weight;
+            state.interval = intervalIndex;
+        }
+        state.time = ++now;
+        Add(state.time, 1);
+
+        if (budget && live > budget)
+            LowerThreshold();
+    }
+
+    // Start a new window, the followed blocks stay
+    VOID ResetStats()
+    {
+        accesses = 0;
+        cold = 0;
+        rate = enabled ? Rate() : 0;
+        for (UINT32 i = 0; i < REUSE_BUCKETS; i++)
+            bucket[i] = 0;
+        workingSet.clear();
+        if (interval && rawAccesses > windowStart)
+            firstInterval += (rawAccesses - windowStart - 1) / interval + 1;
+        windowStart = rawAccesses;
+    }
+
+    VOID MergeStats(const ReuseProfile &other)
+    {
+        accesses += other.accesses;
+        cold += other.cold;
+        if (other.rate > 0 && (rate == 0 || other.rate < rate))
+            rate = other.rate;
+        for (UINT32 i = 0; i < REUSE_BUCKETS; i++)
+            bucket[i] += other.bucket[i];
+        if (other.workingSet.size() > workingSet.size())
+            workingSet.resize(other.workingSet.size(), 0);
+        for (size_t i = 0; i < other.workingSet.size(); i++)
+            workingSet[i] += other.workingSet[i];
+    }
+
+  private:
+    typedef struct _BlockState
+    {
+        UINT64 time = 0;
+        UINT64 interval = 0;
+    } BlockState;
+
+    BOOL enabled;
+    UINT32 threshold; // blocks whose hash is below are followed
+    UINT64 budget;    // most followed blocks in sampled mode, 0 in exact mode
+    UINT64 interval;
+    UINT64 rawAccesses;
+    UINT64 windowStart;   // rawAccesses when the window started
+    UINT64 firstInterval; // index of its first interval, the block states keep theirs
+    UINT64 now;
+    UINT64 live;               // marks in the tree, one per followed block
+    std::vector<UINT32> marks; // Fenwick tree over times 1..size-1
+    std::unordered_map<UINT64, BlockState> blocks;
+
+    static inline UINT32 Bucket(UINT64 distance)
+    {
+        if (distance == 0)
+            return 0;
+        UINT32 bits = 64 - __builtin_clzll(distance);
+        return bits < REUSE_BUCKETS ? bits : REUSE_BUCKETS - 1;
+    }
+
+    static inline UINT32 Hash(UINT64 block)
+    {
+        UINT64 x = block * 0x9e3779b97f4a7c15ULL;
+        x ^= x >> 31;
+        return (UINT32)(x >> (64 - REUSE_HASH_BITS));
+    }
+
+    inline VOID Add(UINT64 time, INT32 delta)
+    {
+        for (; time < marks.size(); time += time & (0 - time))
+            marks[time] += delta;
+    }
+
+    inline UINT64 Prefix(UINT64 time) const
+    {
+        UINT64 sum = 0;
+        for (; time; time -= time & (0 - time))
+            sum += marks[time];
+        return sum;
+    }
+
+    // Renumber the followed blocks 1..live in access order and rebuild the tree with room to grow
+    VOID Compact()
+    {
+        std::vector<std::pair<UINT64, BlockState *> > order;
+        order.reserve(blocks.size());
+        for (auto it = blocks.begin(); it != blocks.end(); it++)
+            order.push_back(std::make_pair(it->second.time, &it->second));
+        std::sort(order.begin(), order.end());
+        marks.assign(std::max((UINT64)REUSE_MIN_TIMES, 2 * live) + 1, 0);
+        for (size_t i = 0; i < order.size(); i++)
+            order[i].second->time = i + 1;
+        now = order.size();
+        // linear Fenwick build: every time has one mark, push each node into its parent
+        for (UINT64 time = 1; time < marks.size(); time++)
+        {
+            marks[time] += time <= now ? 1 : 0;
+            UINT64 parent = time + (time & (0 - time));
+            if (parent < marks.size())
+                marks[parent] += marks[time];
+        }
+    }
+
+    // Follow a quarter fewer blocks and drop the ones above the new threshold
+    VOID LowerThreshold()
+    {
+        threshold -= threshold / 4 ? threshold / 4 : 1;
+        rate = Rate();
+        for (auto it = blocks.begin(); it != blocks.end();)
+        {
+            if (Hash(it->first) < threshold)
+            {
+                it++;
+                continue;
+            }
+            Add(it->second.time, -1);
+            live--;
+            it = blocks.erase(it);
+        }
+    }
+};
+
+#endif
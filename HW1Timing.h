@@ -0,0 +1,255 @@
+/*
+ * Dataflow timing model of an out of order core behind -timing, an
+ * alternative to the serial PART B CPI.
+ *
+ * Instructions dispatch in order, at most width per cycle, into a reorder
+ * buffer of robSize entries kept as a ring of retire cycles: an instruction
+ * cannot dispatch before the one robSize older has retired. It starts when it
+ * is dispatched and its source registers are ready, takes its latency, makes
+ * its destination registers ready and retires in order, width per cycle.
+ * Register ready times live in one flat array indexed by the full Pin register,
+ * so partial registers (al, ax, eax) depend on each other like on the hardware.
+ *
+ * Loads take the latency the cache model charged their accesses, or memLatency
+ * without it; everything else takes one cycle. Memory dependences through
+ * stores, branch mispredictions and functional unit limits are not modelled.
+ * A second set of ready times with no dispatch limits gives the critical
+ * path, and loads slower than the L1D give the memory level parallelism.
+ */
+
+#ifndef HW1_TIMING_H
+#define HW1_TIMING_H
+
+#include "HW1Types.h"
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+#define TIMING_REGS 1024     // Pin register numbers above this are ignored
+#define TIMING_MAX_REGS 12   // register operands kept per instruction, reads then writes
+#define TIMING_LATENCIES 256 // data access latencies queued per block
+#define MAX_ROB_SIZE 4096
+
+// Static part of one instruction, built in Trace() next to the block records
+typedef struct _TimingIns
+{
+    UINT8 numReads;
+    UINT8 numWrites;
+    UINT8 memOperands;
+    UINT8 memRead; // a load, waits for its data access
+    UINT16 regs[TIMING_MAX_REGS];
+} TimingIns;
+
+class TimingModel
+{
+  public:
+    UINT64 instructions;
+    UINT64 loads;
+    UINT64 loadCycles; // latency of the loads
+    UINT64 missCycles; // latency of the loads slower than the L1D
+    UINT64 missBusy;   // cycles with at least one such load in flight
+
+    TimingModel()
+        : instructions(0), loads(0), loadCycles(0), missCycles(0), missBusy(0), enabled(FALSE), queued(FALSE), robSize(0), width(0), hitLatency(0),
+          memLatency(0), numLatencies(0), ready(0), dataflowReady(0), rob(0), robHead(0), dispatchCycle(0), dispatched(0),
+          retireCycle(0), retired(0), dataflowEnd(0), missEnd(0), windowCycle(0), windowDataflow(0)
+    {
+    }
+    TimingModel(const TimingModel &) = delete;
+    TimingModel &operator=(const TimingModel &) = delete;
+
+    ~TimingModel()
+    {
+        free(ready);
+        free(dataflowReady);
+        free(rob);
+    }
+
+    // cacheLatencies: the cache model queues the latency of every data access, see Latency()
+    VOID Init(UINT32 reorderBuffer, UINT32 issueWidth, BOOL cacheLatencies, UINT32 l1dLatency, UINT32 memoryLatency)
+    {
+        queued = cacheLatencies;
+        robSize = reorderBuffer;
+        width = issueWidth;
+        hitLatency = l1dLatency;
+        memLatency = memoryLatency;
+        ready = (UINT64 *)calloc(TIMING_REGS, sizeof(UINT64));
+        dataflowReady = (UINT64 *)calloc(TIMING_REGS, sizeof(UINT64));
+        rob = (UINT64 *)calloc(robSize, sizeof(UINT64));
+        enabled = TRUE;
+    }
+
+    inline BOOL Enabled() const
+    {
+        return enabled;
+    }
+
+    // Latency of the next data access of the current block, in program order
+    inline VOID Latency(UINT32 cycles)
+    {
+        if (numLatencies < TIMING_LATENCIES)
+            latencies[numLatencies++] = cycles;
+    }
+
+    // Run the instructions of a block that just executed, in order. Its data
+    // accesses queued their latencies; a predicated access that did not run
+    // shifts the later ones of the block, a missing one counts as an L1D hit.
+    VOID Block(const std::vector<TimingIns> &block)
+    {
+        UINT32 next = 0;
+        for (auto ins = block.begin(); ins != block.end(); ins++)
+        {
+            UINT32 data = queued ? 0 : memLatency;
+            for (UINT32 i = 0; queued && i < ins->memOperands; i++, next++)
+            {
+                UINT32 cycles = next < numLatencies ? latencies[next] : hitLatency;
+                if (cycles > data)
+                    data = cycles;
+            }
+            Run(*ins, ins->memRead && data > 1 ? data : 1);
+        }
+        numLatencies = 0;
+    }
+
+    inline UINT64 Cycles() const
+    {
+        return retireCycle - windowCycle;
+    }
+
+    inline UINT64 CriticalPath() const
+    {
+        return dataflowEnd - windowDataflow;
+    }
+
+    // Start a new window, the pipeline and register state carry on
+    VOID ResetStats()
+    {
+        instructions = 0;
+        loads = 0;
+        loadCycles = 0;
+        missCycles = 0;
+        missBusy = 0;
+        mergedCycles = 0;
+        mergedCriticalPath = 0;
+        windowCycle = retireCycle;
+        windowDataflow = dataflowEnd;
+    }
+
+    // Threads add up their cycles like their instructions, the critical path is the longest one
+    VOID MergeStats(const TimingModel &other)
+    {
+        instructions += other.instructions;
+        loads += other.loads;
+        loadCycles += other.loadCycles;
+        missCycles += other.missCycles;
+        missBusy += other.missBusy;
+        mergedCycles += other.TotalCycles();
+        if (other.TotalCriticalPath() > mergedCriticalPath)
+            mergedCriticalPath = other.TotalCriticalPath();
+    }
+
+    // Totals of a merged model, or of this thread when nothing was merged
+    inline UINT64 TotalCycles() const
+    {
+        return enabled ? Cycles() : mergedCycles;
+    }
+
+    inline UINT64 TotalCriticalPath() const
+    {
+        return enabled ? CriticalPath() : mergedCriticalPath;
+    }
+
+  private:
+    BOOL enabled;
+    BOOL queued;
+    UINT32 robSize;
+    UINT32 width;
+    UINT32 hitLatency;
+    UINT32 memLatency;
+    UINT32 numLatencies;
+    UINT32 latencies[TIMING_LATENCIES];
+    UINT64 *ready;         // cycle each register is ready
+    UINT64 *dataflowReady; // same with unlimited dispatch
+    UINT64 *rob;           // retire cycle of the last robSize instructions
+    UINT32 robHead;
+    UINT64 dispatchCycle;
+    UINT32 dispatched; // in dispatchCycle
+    UINT64 retireCycle;
+    UINT32 retired; // in retireCycle
+    UINT64 dataflowEnd;
+    UINT64 missEnd;
+    UINT64 windowCycle;
+    UINT64 windowDataflow;
+    UINT64 mergedCycles = 0;
+    UINT64 mergedCriticalPath = 0;
+
+    inline VOID Run(const TimingIns &ins, UINT32 latency)
+    {
+        // in order dispatch, width per cycle, once the ROB has room
+        if (dispatched == width)
+        {
+            dispatchCycle++;
+            dispatched = 0;
+        }
+        UINT64 &slot = rob[robHead];
+        if (slot > dispatchCycle)
+        {
+            dispatchCycle = slot;
+            dispatched = 0;
+        }
+        dispatched++;
+
+        UINT64 start = dispatchCycle;
+        UINT64 dataflowStart = 0;
+        for (UINT32 i = 0; i < ins.numReads; i++)
+        {
+            UINT32 reg = ins.regs[i];
+            if (ready[reg] > start)
+                start = ready[reg];
+            if (dataflowReady[reg] > dataflowStart)
+                dataflowStart = dataflowReady[reg];
+        }
+        UINT64 done = start + latency;
+        UINT64 dataflowDone = dataflowStart + latency;
+        for (UINT32 i = ins.numReads; i < ins.numReads + ins.numWrites; i++)
+        {
+            ready[ins.regs[i]] = done;
+            dataflowReady[ins.regs[i]] = dataflowDone;
+        }
+        if (dataflowDone > dataflowEnd)
+            dataflowEnd = dataflowDone;
+
+        // in order retirement, width per cycle
+        if (done > retireCycle)
+        {
+            retireCycle = done;
+            retired = 0;
+        }
+        else if (retired == width)
+        {
+            retireCycle++;
+            retired = 0;
+        }
+        retired++;
+        slot = retireCycle;
+        robHead = robHead + 1 == robSize ? 0 : robHead + 1;
+
+        instructions++;
+        if (!ins.memRead)
+            return;
+        loads++;
+        loadCycles += latency;
+        if (latency <= hitLatency)
+            return;
+        // union of the miss intervals, assuming misses mostly start in order
+        missCycles += latency;
+        if (start >= missEnd)
+            missBusy += latency;
+        else if (done > missEnd)
+            missBusy += done - missEnd;
+        if (done > missEnd)
+            missEnd = done;
+    }
+};
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * TLB model and page footprint behind -tlb, with a huge page what-if.
+ *
+ * The data and instruction streams go through an L1 DTLB and ITLB in front of
+ * a unified second level STLB; a miss in both is a page walk. The whole
+ * hierarchy is simulated twice on the same stream, once with 4KB and once
+ * with 2MB pages and the same geometry, so the difference in page walks is
+ * the gain huge pages would bring. The TLBs are the LRU Cache of HW1Cache.h
+ * with the page as line.
+ *
+ * Each stream remembers its last page per page size: consecutive accesses to
+ * it are L1 hits without a lookup. The distinct pages of each stream are
+ * counted too, in the radix bitmaps of the footprint.
+ */
+
+#ifndef HW1_TLB_H
+#define HW1_TLB_H
+
+#include "HW1Types.h"
+#include "HW1Cache.h"
+#include "HW1Footprint.h"
+#include <string>
+#include <cstdio>
+#include <cstring>
+
+#define TLB_PAGE_SIZES 2
+const char *const tlbPageNames[TLB_PAGE_SIZES] = {"4KB", "2MB"};
+const UINT32 tlbPageBits[TLB_PAGE_SIZES] = {12, 21};
+
+enum
+{
+    TLB_DATA = 0,
+    TLB_INS = 1,
+    TLB_STREAMS = 2
+};
+
+enum
+{
+    TLB_DTLB = 0,
+    TLB_ITLB = 1,
+    TLB_STLB = 2,
+    TLB_LEVELS = 3
+};
+const char *const tlbLevelNames[TLB_LEVELS] = {"DTLB", "ITLB", "STLB"};
+
+// Entries and ways of one TLB, 0 entries removes the STLB
+typedef struct _TlbConfig
+{
+    UINT32 entries;
+    UINT32 assoc;
+} TlbConfig;
+
+// Parse entries:ways, e.g. 64:4, with a power of two number of sets
+inline BOOL ParseTlbConfig(const std::string &spec, TlbConfig &config)
+{
+    if (sscanf(spec.c_str(), "%u:%u", &config.entries, &config.assoc) != 2)
+        return FALSE;
+    if (config.entries == 0)
+        return TRUE;
+    return config.assoc != 0 && config.entries % config.assoc == 0 && IsPowerOfTwo(config.entries / config.assoc);
+}
+
+class TlbModel
+{
+  public:
+    UINT64 accesses[TLB_STREAMS][TLB_PAGE_SIZES]; // pages looked up, an access crossing a page counts twice
+    UINT64 misses[TLB_STREAMS][TLB_PAGE_SIZES];   // L1 misses, the STLB accesses
+    UINT64 walks[TLB_STREAMS][TLB_PAGE_SIZES];    // STLB misses
+    FootprintBitmap pages[TLB_STREAMS][TLB_PAGE_SIZES];
+
+    TlbModel() : enabled(FALSE)
+    {
+        ResetStats();
+    }
+    TlbModel(const TlbModel &) = delete;
+    TlbModel &operator=(const TlbModel &) = delete;
+
+    // configs in TLB_DTLB, TLB_ITLB, TLB_STLB order
+    VOID Init(const TlbConfig *configs)
+    {
+        for (UINT32 k = 0; k < TLB_PAGE_SIZES; k++)
+        {
+            for (UINT32 s = 0; s < TLB_STREAMS; s++)
+                l1[s][k].Init(AsCache(configs[s == TLB_DATA ? TLB_DTLB : TLB_ITLB], k), CACHE_POLICY_LRU);
+            stlb[k].Init(AsCache(configs[TLB_STLB], k), CACHE_POLICY_LRU);
+        }
+        enabled = TRUE;
+    }
+
+    inline BOOL Enabled() const
+    {
+        return enabled;
+    }
+
+    inline VOID Data(UINT64 addr, UINT32 size)
+    {
+        if (enabled && size)
+            Access(TLB_DATA, addr, size);
+    }
+
+    inline VOID Fetch(UINT64 addr, UINT32 size)
+    {
+        if (enabled && size)
+            Access(TLB_INS, addr, size);
+    }
+
+    // Start a new window, the TLBs stay warm
+    VOID ResetStats()
+    {
+        memset(last, 0xff, sizeof(last));
+        for (UINT32 s = 0; s < TLB_STREAMS; s++)
+            for (UINT32 k = 0; k < TLB_PAGE_SIZES; k++)
+            {
+                accesses[s][k] = misses[s][k] = walks[s][k] = 0;
+                pages[s][k].Clear();
+            }
+    }
+
+    VOID MergeStats(const TlbModel &other)
+    {
+        for (UINT32 s = 0; s < TLB_STREAMS; s++)
+            for (UINT32 k = 0; k < TLB_PAGE_SIZES; k++)
+            {
+                accesses[s][k] += other.accesses[s][k];
+                misses[s][k] += other.misses[s][k];
+                walks[s][k] += other.walks[s][k];
+                pages[s][k].Merge(other.pages[s][k]);
+            }
+    }
+
+  private:
+    BOOL enabled;
+    Cache l1[TLB_STREAMS][TLB_PAGE_SIZES];
+    Cache stlb[TLB_PAGE_SIZES];
+    UINT64 last[TLB_STREAMS][TLB_PAGE_SIZES];
+
+    static CacheConfig AsCache(const TlbConfig &config, UINT32 pageSize)
+    {
+        CacheConfig cache;
+        cache.sizeKB = (UINT32)(((UINT64)config.entries << tlbPageBits[pageSize]) / 1024);
+        cache.assoc = config.assoc;
+        cache.lineSize = 1 << tlbPageBits[pageSize];
+        cache.latency = 0;
+        return cache;
+    }
+
+    inline VOID Access(UINT32 s, UINT64 addr, UINT32 size)
+    {
+        for (UINT32 k = 0; k < TLB_PAGE_SIZES; k++)
+        {
+            UINT32 bits = tlbPageBits[k];
+            for (UINT64 page = addr >> bits; page <= (addr + size - 1) >> bits; page++)
+            {
+                accesses[s][k]++;
+                if (page == last[s][k])
+                    continue;
+                last[s][k] = page;
+                pages[s][k].Insert(page);
+                if (l1[s][k].Access(page << bits))
+                    continue;
+                misses[s][k]++;
+                if (!stlb[k].Enabled() || !stlb[k].Access(page << bits))
+                    walks[s][k]++;
+            }
+        }
+    }
+};
+
+#endif
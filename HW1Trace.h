@@ -0,0 +1,216 @@
+/*
+ * Memory access trace written by the HW1 tool (-trace) and replayed by HW1Replay.
+ *
+ * Layout of a trace file, one per application thread:
+ *   HW1TraceHeader
+ *   chunks of { HW1TraceChunkHeader, bytes of records }
+ * Every chunk holds one Pin trace buffer and starts from a zero delta state,
+ * so chunks can be decoded independently of each other.
+ *
+ * Records are HW1TraceRaw structs with -trace_raw 1, otherwise encoded as
+ *   tag byte    type in bits 0-2, size in bits 3-7 (31 means a varint size follows)
+ *   varint      zigzag(ip - previous ip)
+ *   varint      zigzag(ea - previous data ea) for data records,
+ *               instruction count for block records, nothing for exec records
+ *
+ * The static file <prefix>.static.hw1t holds the basic block records the
+ * trace refers to: HW1StaticHeader, then per block HW1StaticBlock followed by
+ * numSummaries InsSummary structs (see HW1Core.h).
+ */
+
+#ifndef HW1_TRACE_H
+#define HW1_TRACE_H
+
+#include "HW1Types.h"
+#include <vector>
+
+#define HW1_TRACE_MAGIC "HW1T"
+#define HW1_STATIC_MAGIC "HW1S"
+#define HW1_TRACE_VERSION 4
+
+// Record types. A memory operand that is read and written is both, and the
+// operands of predicated instructions are flagged so that the replay can count
+// their executions. Predicated instructions without operand records get one
+// exec record per execution.
+enum
+{
+    TRACE_BLOCK = 0, // ip = block address, size = block bytes, ea = instructions in the block
+    TRACE_READ = 1,
+    TRACE_WRITE = 2,
+    TRACE_READ_WRITE = 3,
+    TRACE_PREDICATED = 4,
+    TRACE_EXEC = TRACE_PREDICATED
+};
+
+enum
+{
+    TRACE_FORMAT_VARINT = 0,
+    TRACE_FORMAT_RAW = 1
+};
+
+typedef struct _HW1TraceHeader
+{
+    char magic[4];
+    UINT32 version;
+    UINT32 tid;
+    UINT32 format;
+} HW1TraceHeader;
+
+typedef struct _HW1TraceChunkHeader
+{
+    UINT32 bytes;
+    UINT32 records;
+} HW1TraceChunkHeader;
+
+typedef struct _HW1TraceRaw
+{
+    UINT64 ip;
+    UINT64 ea;
+    UINT32 size;
+    UINT32 type;
+} HW1TraceRaw;
+
+typedef struct _HW1StaticHeader
+{
+    char magic[4];
+    UINT32 version;
+    UINT32 numBlocks;
+    UINT32 addressBits; // of the traced program, 32 on ia32 and 64 on intel64
+    UINT64 windowStart; // instruction count at which the captured window started
+    UINT32 windowIndex;
+    UINT32 reserved;
+} HW1StaticHeader;
+
+typedef struct _HW1StaticBlock
+{
+    UINT64 address;
+    UINT32 numIns;
+    UINT32 numSummaries;
+} HW1StaticBlock;
+
+class HW1TraceEncoder
+{
+  public:
+    std::vector<UINT8> data;
+    UINT32 records;
+
+    HW1TraceEncoder() : records(0), lastIp(0), lastEa(0) {}
+
+    VOID Begin()
+    {
+        data.clear();
+        records = 0;
+        lastIp = 0;
+        lastEa = 0;
+    }
+
+    inline VOID Add(UINT32 type, UINT64 ip, UINT64 ea, UINT32 size)
+    {
+        data.push_back((UINT8)(type | (size < 31 ? size : 31) << 3));
+        if (size >= 31)
+            PutVarint(size);
+        PutVarint(ZigZag(ip - lastIp));
+        lastIp = ip;
+        if (type == TRACE_BLOCK)
+            PutVarint(ea);
+        else if (type != TRACE_EXEC)
+        {
+            PutVarint(ZigZag(ea - lastEa));
+            lastEa = ea;
+        }
+        records++;
+    }
+
+    VOID AddRaw(UINT32 type, UINT64 ip, UINT64 ea, UINT32 size)
+    {
+        HW1TraceRaw raw = {ip, ea, size, type};
+        data.insert(data.end(), (const UINT8 *)&raw, (const UINT8 *)(&raw + 1));
+        records++;
+    }
+
+  private:
+    UINT64 lastIp;
+    UINT64 lastEa;
+
+    static inline UINT64 ZigZag(UINT64 delta)
+    {
+        return (delta << 1) ^ (UINT64)((INT64)delta >> 63);
+    }
+
+    inline VOID PutVarint(UINT64 value)
+    {
+        while (value >= 0x80)
+        {
+            data.push_back((UINT8)(value | 0x80));
+            value >>= 7;
+        }
+        data.push_back((UINT8)value);
+    }
+};
+
+// Returns FALSE if the varint does not end before end
+static inline BOOL GetVarint(const UINT8 *&p, const UINT8 *end, UINT64 &value)
+{
+    value = 0;
+    for (UINT32 shift = 0; p < end && shift < 64; shift += 7)
+    {
+        UINT8 byte = *p++;
+        value |= (UINT64)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static inline UINT64 UnZigZag(UINT64 value)
+{
+    return (value >> 1) ^ (UINT64)(-(INT64)(value & 1));
+}
+
+// Decode one chunk of bytes bytes, handing every record to sink.Record(type, ip, ea, size).
+// Returns FALSE if a record would cross the end of the chunk, the records before it are handed over.
+template <class SINK>
+inline BOOL DecodeTraceChunk(UINT32 format, const UINT8 *p, UINT32 bytes, UINT32 records, SINK &sink)
+{
+    if (format == TRACE_FORMAT_RAW)
+    {
+        const HW1TraceRaw *raw = (const HW1TraceRaw *)p;
+        UINT32 complete = bytes / sizeof(HW1TraceRaw);
+        for (UINT32 i = 0; i < records && i < complete; i++)
+            sink.Record(raw[i].type, raw[i].ip, raw[i].ea, raw[i].size);
+        return records <= complete;
+    }
+
+    const UINT8 *end = p + bytes;
+    UINT64 ip = 0, ea = 0, value;
+    for (UINT32 i = 0; i < records; i++)
+    {
+        if (p == end)
+            return FALSE;
+        UINT32 type = *p & 7;
+        UINT64 size = *p++ >> 3;
+        if (size == 31 && !GetVarint(p, end, size))
+            return FALSE;
+        if (!GetVarint(p, end, value))
+            return FALSE;
+        ip += UnZigZag(value);
+        if (type == TRACE_BLOCK)
+        {
+            if (!GetVarint(p, end, value))
+                return FALSE;
+            sink.Record(type, ip, value, (UINT32)size);
+        }
+        else if (type == TRACE_EXEC)
+            sink.Record(type, ip, 0, (UINT32)size);
+        else
+        {
+            if (!GetVarint(p, end, value))
+                return FALSE;
+            ea += UnZigZag(value);
+            sink.Record(type, ip, ea, (UINT32)size);
+        }
+    }
+    return TRUE;
+}
+
+#endif
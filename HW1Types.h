@@ -0,0 +1,30 @@
+/*
+ * Basic types shared by the HW1 pin tool and the standalone HW1 programs.
+ * The standalone programs are built with -DHW1_STANDALONE and do not need Pin.
+ */
+
+#ifndef HW1_TYPES_H
+#define HW1_TYPES_H
+
+#ifdef HW1_STANDALONE
+#include <cstdint>
+
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef int8_t INT8;
+typedef int16_t INT16;
+typedef int32_t INT32;
+typedef int64_t INT64;
+typedef double FLT64;
+typedef bool BOOL;
+typedef void VOID;
+
+#define TRUE true
+#define FALSE false
+#else
+#include "pin.H"
+#endif
+
+#endif
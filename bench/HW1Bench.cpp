@@ -0,0 +1,189 @@
+/*
+ * HW1Bench: small synthetic workloads for measuring the overhead of the HW1
+ * tool, see bench/run.sh.
+ *
+ * Usage: HW1Bench <workload> [scale]
+ *
+ *   pointer   chase a random cycle through a 8MB array of nodes (cache and TLB misses)
+ *   stream    triad over three 4MB arrays (long runs of loads and stores)
+ *   branchy   data dependent branches on random bytes (mispredictions)
+ *   calls     direct, indirect and recursive calls (call/return heavy)
+ *   simd      SSE2 multiply-add over float vectors (vector and MMX/SSE categories)
+ *
+ * Each workload runs for a few tenths of a second natively at the default
+ * scale of 10 and grows linearly with it. It prints a checksum so the
+ * compiler keeps the work.
+ */
+
+#include "HW1Types.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <emmintrin.h>
+
+using std::vector;
+
+// xorshift32, the same sequence on every run
+static UINT32 Random(UINT32 &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static UINT64 Pointer(UINT32 scale)
+{
+    const UINT32 nodes = 1 << 21;
+    vector<UINT32> next(nodes);
+    vector<UINT32> order(nodes);
+    UINT32 state = 1;
+    for (UINT32 i = 0; i < nodes; i++)
+        order[i] = i;
+    for (UINT32 i = nodes - 1; i > 0; i--)
+        std::swap(order[i], order[Random(state) % (i + 1)]);
+    for (UINT32 i = 0; i < nodes; i++)
+        next[order[i]] = order[(i + 1) % nodes];
+
+    UINT64 sum = 0;
+    UINT32 node = order[0];
+    for (UINT64 step = 0; step < (UINT64)scale * 200000; step++)
+    {
+        node = next[node];
+        sum += node;
+    }
+    return sum;
+}
+
+static UINT64 Stream(UINT32 scale)
+{
+    const UINT32 size = 1 << 20;
+    vector<UINT32> a(size), b(size), c(size);
+    for (UINT32 i = 0; i < size; i++)
+    {
+        b[i] = i;
+        c[i] = size - i;
+    }
+    for (UINT32 pass = 0; pass < scale * 16; pass++)
+        for (UINT32 i = 0; i < size; i++)
+            a[i] = b[i] + 3 * c[i] + pass;
+    UINT64 sum = 0;
+    for (UINT32 i = 0; i < size; i++)
+        sum += a[i];
+    return sum;
+}
+
+static UINT64 Branchy(UINT32 scale)
+{
+    const UINT32 size = 1 << 16;
+    vector<UINT8> bytes(size);
+    UINT32 state = 7;
+    for (UINT32 i = 0; i < size; i++)
+        bytes[i] = (UINT8)Random(state);
+
+    UINT64 sum = 0;
+    for (UINT32 pass = 0; pass < scale * 32; pass++)
+        for (UINT32 i = 0; i < size; i++)
+        {
+            UINT8 x = bytes[i];
+            if (x & 1)
+                sum += x;
+            else if (x & 2)
+                sum ^= x;
+            if (x > 128)
+                sum -= pass;
+            if ((x ^ pass) & 4)
+                sum++;
+        }
+    return sum;
+}
+
+static UINT64 __attribute__((noinline)) Leaf(UINT64 x)
+{
+    return x * 2654435761U + 1;
+}
+
+static UINT64 __attribute__((noinline)) Other(UINT64 x)
+{
+    return (x >> 3) ^ x;
+}
+
+static UINT64 __attribute__((noinline)) Recurse(UINT64 x, UINT32 depth)
+{
+    if (depth == 0)
+        return Leaf(x);
+    return Recurse(x + depth, depth - 1) ^ depth;
+}
+
+static UINT64 Calls(UINT32 scale)
+{
+    UINT64 (*const table[2])(UINT64) = {Leaf, Other};
+    UINT64 sum = 0;
+    for (UINT64 i = 0; i < (UINT64)scale * 400000; i++)
+    {
+        sum += Leaf(i);
+        sum += table[(sum >> 7) & 1](sum);
+        sum += Recurse(i, 8);
+    }
+    return sum;
+}
+
+__attribute__((target("sse2"))) static UINT64 Simd(UINT32 scale)
+{
+    const UINT32 size = 1 << 14; // floats, fits the L1D
+    vector<float> x(size), y(size);
+    for (UINT32 i = 0; i < size; i++)
+    {
+        x[i] = i * 0.5f;
+        y[i] = 1.0f;
+    }
+    __m128 a = _mm_set1_ps(0.999f);
+    __m128 b = _mm_set1_ps(0.001f);
+    for (UINT32 pass = 0; pass < scale * 2048; pass++)
+        for (UINT32 i = 0; i < size; i += 4)
+        {
+            __m128 v = _mm_loadu_ps(&x[i]);
+            __m128 w = _mm_loadu_ps(&y[i]);
+            _mm_storeu_ps(&y[i], _mm_add_ps(_mm_mul_ps(a, w), _mm_mul_ps(b, v)));
+        }
+    FLT64 sum = 0;
+    for (UINT32 i = 0; i < size; i++)
+        sum += y[i];
+    return (UINT64)sum;
+}
+
+typedef struct _Workload
+{
+    const char *name;
+    UINT64 (*run)(UINT32 scale);
+} Workload;
+
+static const Workload workloads[] = {
+    {"pointer", Pointer}, {"stream", Stream}, {"branchy", Branchy}, {"calls", Calls}, {"simd", Simd}};
+
+static int Usage()
+{
+    fprintf(stderr, "Usage: HW1Bench <workload> [scale]\nWorkloads:");
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+        fprintf(stderr, " %s", workloads[i].name);
+    fprintf(stderr, "\n");
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3)
+        return Usage();
+    UINT32 scale = argc == 3 ? (UINT32)atoi(argv[2]) : 10;
+    if (scale == 0)
+        return Usage();
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+        if (strcmp(argv[1], workloads[i].name) == 0)
+        {
+            printf("%s %llu\n", workloads[i].name, (unsigned long long)workloads[i].run(scale));
+            return 0;
+        }
+    return Usage();
+}
@@ -0,0 +1,144 @@
+#!/bin/bash
+
+# Overhead of the HW1 tool on the workloads of bench/HW1Bench.cpp.
+#
+# Every workload runs natively, under Pin without a tool and under the tool in
+# each configuration below; the fastest of the repeats counts. One more run
+# with -call_counts 1, not timed, gives the analysis calls of a configuration.
+# The time a configuration adds over its base, divided by the calls it adds,
+# is the cost of one analysis call:
+#   ff      CheckFastForward (and DoInsCount) once per block, never leaving fast forward
+#   ins     AnalysisMetrics and PredicatedAnalysisMetrics*Mem once per instruction
+#   bbl     DoBblCount and CheckTerminate per block, RecordDataAccess per memory operand
+#   cache   adds FetchBbl per block and the cache model to RecordDataAccess
+#   branch  adds the branch routines per control flow instruction
+#   reuse   adds the reuse profile to RecordDataAccess, no extra calls
+#   windows the reuse profile over four 1M instruction windows, which resets it
+#           between windows; ns_per_call is not meaningful here
+#   all     the cache and branch models together
+#
+# -i adds, per workload, which analysis routines Pin inlined in the all
+# configuration, from the log of pin -log_inline. DoInsCount, CheckFastForward
+# and CheckTerminate are written to be inlined.
+#
+# Usage: bench/run.sh [-a ia32|intel64] [-r repeats] [-s scale] [-i] [workload...]
+# Run from the tool directory after make TARGET=<arch> obj-<arch>/HW1.so obj-<arch>/HW1Bench.
+# PIN selects the pin launcher (default pin from the PATH).
+
+arch=ia32
+repeats=3
+scale=10
+inline=0
+while getopts "a:r:s:ih" opt; do
+    case $opt in
+    a) arch=$OPTARG ;;
+    r) repeats=$OPTARG ;;
+    s) scale=$OPTARG ;;
+    i) inline=1 ;;
+    *)
+        echo "Usage: bench/run.sh [-a ia32|intel64] [-r repeats] [-s scale] [-i] [workload...]"
+        exit 1
+        ;;
+    esac
+done
+shift $((OPTIND - 1))
+workloads=${*:-pointer stream branchy calls simd}
+pin=${PIN:-pin}
+tool=obj-$arch/HW1.so
+app=obj-$arch/HW1Bench
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# name, base configuration, tool flags
+configs=(
+    "ff pin -f 1000"
+    "ins pin -bbl_summary 0"
+    "bbl pin"
+    "cache bbl -cache 1"
+    "branch bbl -branch 1"
+    "reuse bbl -reuse 1"
+    "windows reuse -reuse 1 -reuse_interval 1000 -w 1 -n 4"
+    "all bbl -cache 1 -branch 1"
+)
+
+# Fastest of the repeats, in nanoseconds
+Time() {
+    local best=0 start end
+    for ((i = 0; i < repeats; i++)); do
+        start=$(date +%s%N)
+        "$@" >/dev/null 2>&1
+        end=$(date +%s%N)
+        if ((best == 0 || end - start < best)); then
+            best=$((end - start))
+        fi
+    done
+    echo $best
+}
+
+# Sum of the ANALYSIS CALLS section of a report
+Calls() {
+    awk '/ANALYSIS CALLS/ { on = 1; next } on && NF == 2 { sum += $2 } END { print sum + 0 }' "$1"
+}
+
+Row() {
+    awk -v w="$1" -v c="$2" -v t="$3" -v native="$4" -v pin="$5" -v ins="$6" -v calls="$7" -v base="$8" -v baseCalls="$9" 'BEGIN {
+        ns = "-"; nsIns = "-"
+        if (base != "" && calls - baseCalls > 0)
+            ns = sprintf("%.2f", (t - base) / (calls - baseCalls))
+        if (base != "" && ins > 0)
+            nsIns = sprintf("%.2f", (t - base) / ins)
+        printf "%s\t%s\t%.3f\t%.2f\t%.2f\t%s\t%s\t%s\t%s\n", w, c, t / 1e9, t / native, t / pin, ins, calls, ns, nsIns
+    }'
+}
+
+# Inlining decisions of the analysis routines found in a pin -log_inline log. A routine matches
+# as a whole symbol, demangled or mangled (length prefixed), so AnalysisMetrics does not match
+# PredicatedAnalysisMetrics<N>.
+Inlined() {
+    for routine in CheckFastForward DoInsCount CheckTerminate DoBblCount AnalysisMetrics PredicatedAnalysisMetrics \
+        PredicatedAnalysisMetricsMem RecordDataAccess FetchBbl BranchConditional BranchIndirect BranchCall BranchReturn; do
+        awk -v w="$1" -v r="$routine" 'BEGIN {
+            demangled = "(^|[^A-Za-z0-9_])" r "([^A-Za-z0-9_]|$)"
+            mangled = "(^|[^0-9])" length(r) r
+        } $0 ~ demangled || $0 ~ mangled {
+            seen = 1
+            if (tolower($0) ~ /not inlined|no inline/) no = 1
+            else if (tolower($0) ~ /inlin/) yes = 1
+        } END {
+            printf "%s\tinline\t%s\t%s\n", w, r, no ? (yes ? "partly" : "no") : (yes ? "yes" : (seen ? "unknown" : "not found"))
+        }' "$2"
+    done
+}
+
+for bin in "$tool" "$app"; do
+    if [ ! -e "$bin" ]; then
+        echo "bench/run.sh: $bin not found, build it with make TARGET=$arch $bin" >&2
+        exit 1
+    fi
+done
+
+printf "workload\tconfig\tseconds\tslowdown\tpin_slowdown\tinstructions\tcalls\tns_per_call\tns_per_ins\n"
+for w in $workloads; do
+    declare -A times=() counts=()
+    times[native]=$(Time "$app" "$w" "$scale")
+    times[pin]=$(Time "$pin" -- "$app" "$w" "$scale")
+    counts[pin]=0
+    Row "$w" native "${times[native]}" "${times[native]}" "${times[pin]}" "" "" "" 0
+    Row "$w" pin "${times[pin]}" "${times[native]}" "${times[pin]}" "" "" "${times[native]}" 0
+    for config in "${configs[@]}"; do
+        read -r name base flags <<<"$config"
+        # shellcheck disable=SC2086
+        times[$name]=$(Time "$pin" -t "$tool" -o "$tmp/$name.out" $flags -- "$app" "$w" "$scale")
+        # shellcheck disable=SC2086
+        "$pin" -t "$tool" -o "$tmp/$name.calls" -call_counts 1 $flags -- "$app" "$w" "$scale" >/dev/null 2>&1
+        counts[$name]=$(Calls "$tmp/$name.calls")
+        ins=$(awk '/^Number of instructions:/ { print $4; exit }' "$tmp/$name.calls")
+        Row "$w" "$name" "${times[$name]}" "${times[native]}" "${times[pin]}" "$ins" "${counts[$name]}" \
+            "${times[$base]}" "${counts[$base]}"
+    done
+    if ((inline)); then
+        "$pin" -log_inline -logfile "$tmp/inline.log" -t "$tool" -o "$tmp/inline.out" -- "$app" "$w" "$scale" >/dev/null 2>&1
+        Inlined "$w" "$tmp/inline.log"
+    fi
+    unset times counts
+done
@@ -0,0 +1,268 @@
+/*
+ * HW1Test: unit tests of the analysis core, built without Pin.
+ *
+ * Usage: HW1Test
+ *
+ *   reuse      ReuseProfile distances and working sets against a plain LRU
+ *              stack, over several windows of uneven length
+ *   cache      CacheHierarchy hits, misses and cycles on short sequences
+ *              worked out by hand, per replacement policy
+ *   footprint  exact Footprint sets against std::set, the FootprintSketch
+ *              estimate within four standard errors of the exact count
+ *
+ * Prints every failed check and exits with 1 if there was one.
+ */
+
+#include "HW1Reuse.h"
+#include "HW1Cache.h"
+#include "HW1Footprint.h"
+#include <cstdio>
+#include <cmath>
+#include <list>
+#include <set>
+#include <vector>
+
+using std::vector;
+
+static UINT32 failures = 0;
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+// xorshift32, the same sequence on every run
+static UINT32 Random(UINT32 &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static UINT64 Random64(UINT32 &state)
+{
+    UINT64 high = Random(state);
+    return high << 32 | Random(state);
+}
+
+// Bucket of an LRU stack distance, see REUSE_BUCKETS
+static UINT32 ReuseBucket(UINT64 distance)
+{
+    UINT32 bucket = distance ? 64 - __builtin_clzll(distance) : 0;
+    return bucket < REUSE_BUCKETS ? bucket : REUSE_BUCKETS - 1;
+}
+
+// Exact mode against a list kept in recency order. The windows end at uneven
+// access counts, so their intervals do not line up with the interval length.
+static VOID TestReuse(void)
+{
+    const UINT64 interval = 1000;
+    const UINT64 windows[] = {25000, 7777, 1, 40000};
+    ReuseProfile reuse;
+    reuse.Init(1, 0, interval);
+    std::list<UINT64> stack;
+    UINT32 state = 1;
+    UINT64 i = 0;
+    for (UINT32 w = 0; w < sizeof(windows) / sizeof(windows[0]); w++)
+    {
+        FLT64 bucket[REUSE_BUCKETS] = {};
+        FLT64 cold = 0;
+        vector<std::set<UINT64> > workingSet;
+        for (UINT64 n = 0; n < windows[w]; n++, i++)
+        {
+            // a hot loop over 700 blocks mixed with random blocks out of 5000
+            UINT64 block = (i % 3 == 0) ? Random(state) % 5000 : i % 700;
+            reuse.Insert(block);
+
+            UINT64 distance = 0;
+            BOOL found = FALSE;
+            for (auto it = stack.begin(); it != stack.end(); it++, distance++)
+                if (*it == block)
+                {
+                    stack.erase(it);
+                    found = TRUE;
+                    break;
+                }
+            stack.push_front(block);
+            if (found)
+                bucket[ReuseBucket(distance)]++;
+            else
+                cold++;
+            if (n / interval >= workingSet.size())
+                workingSet.resize(n / interval + 1);
+            workingSet[n / interval].insert(block);
+        }
+
+        CHECK(reuse.accesses == windows[w]);
+        CHECK(reuse.cold == cold);
+        for (UINT32 b = 0; b < REUSE_BUCKETS; b++)
+            CHECK(reuse.bucket[b] == bucket[b]);
+        CHECK(reuse.workingSet.size() == workingSet.size());
+        for (size_t k = 0; k < workingSet.size() && k < reuse.workingSet.size(); k++)
+            CHECK(reuse.workingSet[k] == workingSet[k].size());
+        reuse.ResetStats();
+    }
+
+    // sampling within a budget only follows fewer blocks, it never goes out of bounds
+    ReuseProfile sampled;
+    sampled.Init(0.1, 200, interval);
+    for (i = 0; i < 100000; i++)
+    {
+        sampled.Insert(Random(state) % 50000);
+        if (i % 30001 == 0)
+            sampled.ResetStats();
+    }
+    CHECK(sampled.Rate() < 0.1);
+    CHECK(sampled.rate == sampled.Rate());
+
+    // a merged window reports the lowest rate of its threads
+    ReuseProfile merged;
+    merged.MergeStats(reuse);
+    CHECK(merged.rate == 1);
+    merged.MergeStats(sampled);
+    CHECK(merged.rate == sampled.Rate());
+}
+
+// 1KB 2 way L1D with 64 byte lines (8 sets), 4KB 4 way L2 (16 sets), no LLC.
+// Lines A, B and C map to set 0 of the L1D; A and C share set 0 of the L2.
+static VOID InitSmallHierarchy(CacheHierarchy &caches, const char *policyName, BOOL withL2)
+{
+    const char *specs[CACHE_LEVELS] = {"1:2:64:1", "1:2:64:1", withL2 ? "4:4:64:10" : "0:0:0:0", "0:0:0:0"};
+    CacheConfig configs[CACHE_LEVELS];
+    for (UINT32 i = 0; i < CACHE_LEVELS; i++)
+        CHECK(ParseCacheConfig(specs[i], configs[i], i >= CACHE_L2));
+    UINT32 policy = 0;
+    CHECK(ParseCachePolicy(policyName, policy));
+    caches.Init(configs, policy, 100);
+}
+
+static VOID TestCache(void)
+{
+    const UINT64 A = 0, B = 512, C = 1024;
+    const UINT64 sequence[] = {A, B, A, C, B};
+
+    // LRU: A, B miss, A hits, C evicts B, B evicts A. L2: A, B, C miss, B hits.
+    // Tree PLRU with two ways is the same as LRU.
+    const char *lruPolicies[] = {"lru", "plru"};
+    for (UINT32 p = 0; p < 2; p++)
+    {
+        CacheHierarchy caches;
+        InitSmallHierarchy(caches, lruPolicies[p], TRUE);
+        for (UINT32 i = 0; i < 5; i++)
+            caches.Data(sequence[i], 4);
+        CHECK(caches.level[CACHE_L1D].accesses == 5);
+        CHECK(caches.level[CACHE_L1D].misses == 4);
+        CHECK(caches.level[CACHE_L2].accesses == 4);
+        CHECK(caches.level[CACHE_L2].misses == 3);
+        CHECK(caches.dataCycles == 100 + 100 + 1 + 100 + 10);
+    }
+
+    // FIFO: the hit on A does not refresh it, so C evicts A and B hits
+    CacheHierarchy fifo;
+    InitSmallHierarchy(fifo, "fifo", TRUE);
+    for (UINT32 i = 0; i < 5; i++)
+        fifo.Data(sequence[i], 4);
+    CHECK(fifo.level[CACHE_L1D].misses == 3);
+    CHECK(fifo.level[CACHE_L2].misses == 3);
+    CHECK(fifo.dataCycles == 100 + 100 + 1 + 100 + 1);
+
+    // an access across a line boundary looks up both lines; without an L2 a miss costs the memory latency
+    CacheHierarchy split;
+    InitSmallHierarchy(split, "lru", FALSE);
+    split.Data(60, 8);
+    split.Data(60, 8);
+    CHECK(split.level[CACHE_L1D].accesses == 4);
+    CHECK(split.level[CACHE_L1D].misses == 2);
+    CHECK(split.level[CACHE_L2].accesses == 0);
+    CHECK(split.dataCycles == 100 + 100 + 1 + 1);
+
+    // L1I hits are free, misses cost the level below
+    CacheHierarchy fetch;
+    InitSmallHierarchy(fetch, "lru", TRUE);
+    fetch.Fetch(0x1000, 16);
+    fetch.Fetch(0x1000, 16);
+    CHECK(fetch.level[CACHE_L1I].misses == 1);
+    CHECK(fetch.fetchCycles == 100);
+    fetch.ResetStats();
+    CHECK(fetch.level[CACHE_L1I].accesses == 0);
+    fetch.Fetch(0x1000, 16);
+    CHECK(fetch.level[CACHE_L1I].misses == 0);
+
+    CacheConfig config;
+    CHECK(ParseCacheConfig("48:12:64:1", config, FALSE));
+    CHECK(!ParseCacheConfig("3:2:64:1", config, FALSE));
+    CHECK(!ParseCacheConfig("32:8:48:1", config, FALSE));
+    CHECK(!ParseCacheConfig("32:0:64:1", config, FALSE));
+    // size 0 removes an L2 or LLC, an L1 cannot be removed
+    CHECK(ParseCacheConfig("0:0:0:0", config, TRUE));
+    CHECK(!ParseCacheConfig("0:8:64:1", config, FALSE));
+}
+
+static VOID TestFootprint(void)
+{
+    UINT32 state = 7;
+    std::set<UINT64> exact;
+    Footprint unbounded, first, second;
+    unbounded.Init(0, 14);
+    first.Init(0, 14);
+    second.Init(0, 14);
+    for (UINT32 i = 0; i < 200000; i++)
+    {
+        // sparse blocks over the whole address space and dense ones in one region
+        UINT64 block = i % 2 ? Random64(state) >> (64 - FOOTPRINT_ADDRESS_BITS + 5) : 0x1000000 + Random(state) % 50000;
+        exact.insert(block);
+        unbounded.Insert(block);
+        (i % 3 ? first : second).Insert(block);
+    }
+    CHECK(!unbounded.Estimated());
+    CHECK(unbounded.Size() == exact.size());
+    first.Merge(second);
+    CHECK(first.Size() == exact.size());
+
+    // the sketch on its own, then a budget that runs out half way
+    const UINT32 bits[] = {10, 14};
+    for (UINT32 b = 0; b < 2; b++)
+    {
+        FootprintSketch sketch;
+        sketch.Init(bits[b]);
+        Footprint budgeted;
+        budgeted.Init(64 << 10, bits[b]);
+        for (std::set<UINT64>::const_iterator it = exact.begin(); it != exact.end(); it++)
+        {
+            sketch.Insert(*it);
+            budgeted.Insert(*it);
+        }
+        FLT64 error = 1.04 / sqrt((FLT64)(1 << bits[b]));
+        CHECK(fabs(sketch.StandardError() - error) < 1e-9);
+        CHECK(fabs((FLT64)sketch.Size() / exact.size() - 1) < 4 * error);
+        CHECK(budgeted.Estimated());
+        CHECK(fabs((FLT64)budgeted.Size() / exact.size() - 1) < 4 * error);
+    }
+
+    // few blocks: the linear counting range of the sketch
+    FootprintSketch small;
+    small.Init(14);
+    for (UINT64 block = 0; block < 100; block++)
+        small.Insert(block * 7919);
+    CHECK(small.Size() >= 95 && small.Size() <= 105);
+}
+
+int main()
+{
+    TestReuse();
+    TestCache();
+    TestFootprint();
+    if (failures)
+    {
+        fprintf(stderr, "HW1Test: %u checks failed\n", failures);
+        return 1;
+    }
+    printf("HW1Test: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * HW1TestTrace: write a synthetic -trace capture for testing HW1Replay.
+ *
+ * Usage: HW1TestTrace prefix
+ *
+ * Writes <prefix>.static.hw1t with two basic blocks and <prefix>.<tid>.hw1t
+ * for three threads, alternating the varint and raw formats, in chunks of a
+ * few thousand records like the tool's Pin buffers. The blocks have plain,
+ * predicated and multi operand memory instructions and a predicated
+ * instruction without operands, so every record type occurs. The data
+ * addresses mix a stride with random accesses, so the cache model misses.
+ */
+
+#include "HW1Core.h"
+#include "HW1Trace.h"
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <string>
+
+using std::string;
+
+#define TEST_THREADS 3
+#define TEST_CHUNKS 40
+#define TEST_CHUNK_RECORDS 3000
+
+// xorshift32, the same sequence on every run
+static UINT32 Random(UINT32 &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static InsSummary MakeIns(UINT64 insAddr, UINT32 insSize, UINT32 insTypeOffset, INT64 immediate, INT64 displacement)
+{
+    InsSummary ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.insAddr = insAddr;
+    ins.insSize = insSize;
+    ins.operandsCount = 2;
+    ins.regReadCount = 1;
+    ins.regWriteCount = 1;
+    ins.immediateMin = ins.immediateMax = immediate;
+    ins.insTypeOffset = insTypeOffset;
+    ins.displacementMax = ins.displacementMin = displacement;
+    return ins;
+}
+
+static BOOL WriteStatic(const string &prefix)
+{
+    // block 1: a load, a predicated store and a predicated instruction without memory operands
+    InsSummary block1[3];
+    block1[0] = MakeIns(0x401000, 4, offsetof(InstMetrics, numRest), 16, 8);
+    block1[0].memOperands = block1[0].numLoads = block1[0].readOperands = 1;
+    block1[0].memTouched = 8;
+    block1[1] = MakeIns(0x401004, 4, offsetof(InstMetrics, numCondMoves), -3, -24);
+    block1[1].predicated = 1;
+    block1[1].memOperands = block1[1].numStores = block1[1].writeOperands = 1;
+    block1[1].memTouched = 4;
+    block1[2] = MakeIns(0x401008, 2, offsetof(InstMetrics, numCondMoves), 0, 0);
+    block1[2].predicated = 1;
+    // block 2: a read-modify-write of two operands and a conditional branch
+    InsSummary block2[2];
+    block2[0] = MakeIns(0x402000, 5, offsetof(InstMetrics, numLogicalOps), 1 << 20, 4096);
+    block2[0].memOperands = 2;
+    block2[0].numLoads = block2[0].numStores = 1;
+    block2[0].readOperands = block2[0].writeOperands = 1;
+    block2[0].memTouched = 16;
+    block2[1] = MakeIns(0x402005, 2, offsetof(InstMetrics, numCondBranches), -128, 0);
+
+    FILE *file = fopen((prefix + ".static.hw1t").c_str(), "wb");
+    if (file == 0)
+        return FALSE;
+    HW1StaticHeader header = {{'H', 'W', '1', 'S'}, HW1_TRACE_VERSION, 2, 64, 1000000, 0, 0};
+    HW1StaticBlock static1 = {0x401000, 3, 3};
+    HW1StaticBlock static2 = {0x402000, 2, 2};
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(&static1, sizeof(static1), 1, file);
+    fwrite(block1, sizeof(block1), 1, file);
+    fwrite(&static2, sizeof(static2), 1, file);
+    fwrite(block2, sizeof(block2), 1, file);
+    return fclose(file) == 0;
+}
+
+static VOID Add(HW1TraceEncoder &encoder, UINT32 format, UINT32 type, UINT64 ip, UINT64 ea, UINT32 size)
+{
+    if (format == TRACE_FORMAT_RAW)
+        encoder.AddRaw(type, ip, ea, size);
+    else
+        encoder.Add(type, ip, ea, size);
+}
+
+static BOOL WriteThread(const string &prefix, UINT32 tid, UINT32 format)
+{
+    FILE *file = fopen((prefix + "." + std::to_string(tid) + ".hw1t").c_str(), "wb");
+    if (file == 0)
+        return FALSE;
+    HW1TraceHeader header = {{'H', 'W', '1', 'T'}, HW1_TRACE_VERSION, tid, format};
+    fwrite(&header, sizeof(header), 1, file);
+
+    UINT32 state = 1 + tid;
+    UINT64 stream = 0x10000000 + ((UINT64)tid << 24);
+    HW1TraceEncoder encoder;
+    for (UINT32 c = 0; c < TEST_CHUNKS; c++)
+    {
+        // the records of one block execution never straddle two chunks, like Pin's buffers
+        encoder.Begin();
+        while (encoder.records < TEST_CHUNK_RECORDS)
+        {
+            UINT32 random = Random(state);
+            if (random & 1)
+            {
+                Add(encoder, format, TRACE_BLOCK, 0x401000, 3, 10);
+                Add(encoder, format, TRACE_READ, 0x401000, stream, 8);
+                stream += 8;
+                if (random & 2)
+                    Add(encoder, format, TRACE_WRITE | TRACE_PREDICATED, 0x401004, 0x20000000 + (random >> 8) % (1 << 22), 4);
+                if (random & 4)
+                    Add(encoder, format, TRACE_EXEC, 0x401008, 0, 0);
+            }
+            else
+            {
+                UINT64 ea = 0x30000000 + (random >> 4) % (1 << 16) * 8;
+                Add(encoder, format, TRACE_BLOCK, 0x402000, 2, 7);
+                Add(encoder, format, TRACE_READ, 0x402000, ea, 8);
+                Add(encoder, format, TRACE_WRITE, 0x402000, ea + 60, 8);
+            }
+        }
+        HW1TraceChunkHeader chunk = {(UINT32)encoder.data.size(), encoder.records};
+        fwrite(&chunk, sizeof(chunk), 1, file);
+        fwrite(encoder.data.data(), 1, encoder.data.size(), file);
+    }
+    return fclose(file) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: HW1TestTrace prefix\n");
+        return 1;
+    }
+    string prefix = argv[1];
+    BOOL written = WriteStatic(prefix);
+    for (UINT32 tid = 0; tid < TEST_THREADS; tid++)
+        written = written && WriteThread(prefix, tid, tid % 2 ? TRACE_FORMAT_RAW : TRACE_FORMAT_VARINT);
+    if (!written)
+    {
+        fprintf(stderr, "HW1TestTrace: cannot write %s\n", prefix.c_str());
+        return 1;
+    }
+    return 0;
+}